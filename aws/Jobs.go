@@ -0,0 +1,176 @@
+package main
+
+import (
+	// #include <stdbool.h>
+	// #include <stdint.h>
+	// #include <stdlib.h>
+	// #include "dns.h"
+	"C"
+
+	"fmt"
+	"sync"
+	"syscall"
+	"unsafe"
+
+	"github.com/aws/aws-sdk-go/service/route53"
+)
+
+// Every API operation runs as a job in its own goroutine. The PostgreSQL
+// side starts a job, waits for the notification pipe to become readable
+// and then collects the result -- from its main thread, which is the only
+// one allowed to touch PostgreSQL.
+
+type jobResult struct {
+	err string
+	notice string
+	debug string
+	success bool
+	count int64
+	rrsets []*route53.ResourceRecordSet
+	nextName *string
+	nextType *string
+	nextIdentifier *string
+	zones []*route53.HostedZone
+}
+
+type job struct {
+	done bool
+	forgotten bool
+	result jobResult
+}
+
+var jobs = map[int64]*job{}
+var jobsMutex sync.Mutex
+var lastJobId int64
+var notifyFd = -1
+
+//export r53dbGoInit
+func r53dbGoInit(fd C.int) {
+	notifyFd = int(fd)
+}
+
+func startJob(options connOptions, run func(r53 *route53.Route53, r *jobResult)) C.int64_t {
+	jobsMutex.Lock()
+	lastJobId++
+	id := lastJobId
+	j := &job{}
+	jobs[id] = j
+	jobsMutex.Unlock()
+
+	go func() {
+		var r jobResult
+		defer finishJob(id, j, &r)
+
+		r53, err := awsConnect(options)
+		if err != nil {
+			r.err = "unable to load SDK config, " + err.Error()
+			return
+		}
+
+		run(r53, &r)
+	}()
+
+	return C.int64_t(id)
+}
+
+func finishJob(id int64, j *job, r *jobResult) {
+	if p := recover(); p != nil {
+		r.err = fmt.Sprintf("r53db: internal error: %v", p)
+	}
+
+	jobsMutex.Lock()
+	if j.forgotten {
+		delete(jobs, id)
+	} else {
+		j.result = *r
+		j.done = true
+	}
+	jobsMutex.Unlock()
+
+	// The pipe is non-blocking: if it's full, a wakeup is pending anyway.
+	syscall.Write(notifyFd, []byte{0})
+}
+
+//export r53dbGoJobDone
+func r53dbGoJobDone(id C.int64_t) C.bool {
+	jobsMutex.Lock()
+	defer jobsMutex.Unlock()
+
+	j, ok := jobs[int64(id)]
+	return C.bool(ok && j.done)
+}
+
+// The caller isn't interested in the result anymore (e.g. the query was
+// cancelled); the job is dropped as soon as it's done.
+//export r53dbGoJobForget
+func r53dbGoJobForget(id C.int64_t) {
+	jobsMutex.Lock()
+	defer jobsMutex.Unlock()
+
+	j, ok := jobs[int64(id)]
+	if !ok {
+		return
+	}
+
+	if j.done {
+		delete(jobs, int64(id))
+	} else {
+		j.forgotten = true
+	}
+}
+
+// Hand over the result of a finished job, in malloc()ed memory.
+//export r53dbGoJobResult
+func r53dbGoJobResult(id C.int64_t, result *C.r53dbAWSResult) {
+	jobsMutex.Lock()
+	j, ok := jobs[int64(id)]
+	if ok && j.done {
+		delete(jobs, int64(id))
+	}
+	jobsMutex.Unlock()
+
+	if !ok || !j.done {
+		result.error = C.CString(fmt.Sprintf("r53db: internal error: job %d is not done", id))
+		return
+	}
+
+	r := &j.result
+
+	if r.err != "" {
+		result.error = C.CString(r.err)
+	}
+	if r.notice != "" {
+		result.notice = C.CString(r.notice)
+	}
+	if r.debug != "" {
+		result.debug = C.CString(r.debug)
+	}
+	result.success = C.bool(r.success)
+	result.count = C.int64_t(r.count)
+
+	var rows []C.r53dbDNSRR
+	for _, rrset := range r.rrsets {
+		rows = append(rows, rowsFromRRSet(rrset)...)
+	}
+
+	if len(rows) > 0 {
+		result.nrows = C.int(len(rows))
+		result.rows = (*C.r53dbDNSRR)(C.calloc(C.size_t(len(rows)), C.size_t(unsafe.Sizeof(rows[0]))))
+		copy((*[1 << 28]C.r53dbDNSRR)(unsafe.Pointer(result.rows))[:len(rows):len(rows)], rows)
+	}
+
+	result.next_name = CStringOrNil(r.nextName)
+	result.next_type = CStringOrNil(r.nextType)
+	result.next_identifier = CStringOrNil(r.nextIdentifier)
+
+	if len(r.zones) > 0 {
+		result.nzones = C.int(len(r.zones))
+		result.zones = (*C.r53dbZone)(C.calloc(C.size_t(len(r.zones)), C.size_t(unsafe.Sizeof(C.r53dbZone{}))))
+		zones := (*[1 << 28]C.r53dbZone)(unsafe.Pointer(result.zones))[:len(r.zones):len(r.zones)]
+
+		for i, zone := range r.zones {
+			zones[i].id = C.CString(*zone.Id)
+			zones[i].name = C.CString(*zone.Name)
+		}
+	}
+}
@@ -0,0 +1,167 @@
+package main
+
+// r53db_aws.so: The AWS side of r53db, built as a separate shared library
+// so the Go runtime is only started in processes that actually talk to
+// AWS (see go_functions.c). Nothing in here may call into PostgreSQL:
+// all work runs in goroutines, and results are picked up by the caller.
+
+import (
+	// #cgo CFLAGS: -I${SRCDIR}/.. -Wall -Werror
+	// #include <stdbool.h>
+	// #include <stdint.h>
+	// #include "dns.h"
+	"C"
+
+	"net/http"
+	"sync"
+	"time"
+
+	"github.com/aws/aws-sdk-go/aws"
+	"github.com/aws/aws-sdk-go/aws/credentials"
+	"github.com/aws/aws-sdk-go/aws/credentials/stscreds"
+	"github.com/aws/aws-sdk-go/aws/session"
+	"github.com/aws/aws-sdk-go/service/route53"
+)
+
+// Go-side copy of r53dbConnOptions, so it can be compared and kept
+// beyond the lifetime of the (palloc'ed) C struct.
+type connOptions struct {
+	region string
+	endpoint string
+	profile string
+	accessKeyId string
+	secretAccessKey string
+	sessionToken string
+	roleArn string
+}
+
+// Clients (including their credentials, which refresh themselves as
+// needed) are kept for the lifetime of the process, keyed by the
+// connection settings themselves: User mapping OIDs are only unique per
+// database, and the broker serves all databases.
+var awsConnections = map[connOptions]*route53.Route53{}
+var awsConnectionsMutex sync.Mutex
+
+// All sessions share one keep-alive transport, so TLS connections to the
+// Route53 endpoint are reused across queries and user mappings.
+var awsTransport *http.Transport
+
+func newTransport() *http.Transport {
+	t := http.DefaultTransport.(*http.Transport).Clone()
+	t.MaxIdleConns = 16
+	t.MaxIdleConnsPerHost = 4
+	t.IdleConnTimeout = 5 * time.Minute
+	return t
+}
+
+func connOptionsFromC(c *C.r53dbConnOptions) connOptions {
+	return connOptions{
+		region: C.GoString(c.region),
+		endpoint: C.GoString(c.endpoint),
+		profile: C.GoString(c.profile),
+		accessKeyId: C.GoString(c.access_key_id),
+		secretAccessKey: C.GoString(c.secret_access_key),
+		sessionToken: C.GoString(c.session_token),
+		roleArn: C.GoString(c.role_arn),
+	}
+}
+
+// Route53 allows only five requests per second per account, which
+// concurrent scans (or other API users) can easily exceed. Throttled
+// requests are retried with exponential backoff; the SDK default of
+// three retries gives up too quickly for that.
+const awsMaxRetries = 10
+
+func newRoute53(o connOptions) (*route53.Route53, error) {
+	if awsTransport == nil {
+		awsTransport = newTransport()
+	}
+
+	cfg := aws.NewConfig().
+		WithHTTPClient(&http.Client{Transport: awsTransport}).
+		WithMaxRetries(awsMaxRetries)
+
+	if o.region != "" {
+		cfg = cfg.WithRegion(o.region)
+	}
+
+	if o.endpoint != "" {
+		cfg = cfg.WithEndpoint(o.endpoint)
+	}
+
+	if o.accessKeyId != "" {
+		cfg = cfg.WithCredentials(credentials.NewStaticCredentials(o.accessKeyId, o.secretAccessKey, o.sessionToken))
+	}
+
+	session, err := session.NewSessionWithOptions(session.Options{
+		Config: *cfg,
+		Profile: o.profile,
+	})
+	if err != nil {
+		return nil, err
+	}
+
+	if o.roleArn != "" {
+		return route53.New(session, aws.NewConfig().WithCredentials(stscreds.NewCredentials(session, o.roleArn))), nil
+	}
+
+	return route53.New(session), nil
+}
+
+func awsConnect(options connOptions) (*route53.Route53, error) {
+	awsConnectionsMutex.Lock()
+	defer awsConnectionsMutex.Unlock()
+
+	if r53, ok := awsConnections[options]; ok {
+		return r53, nil
+	}
+
+	r53, err := newRoute53(options)
+	if err != nil {
+		return nil, err
+	}
+
+	awsConnections[options] = r53
+
+	return r53, nil
+}
+
+func GoCharStringPtr(c *C.char) *string {
+	s := C.GoString(c)
+	return &s
+}
+
+func GoCharStringPtrOrNil(c *C.char) *string {
+	if c == nil {
+		return nil
+	}
+
+	return GoCharStringPtr(c)
+}
+
+func CStringOrNil(s *string) *C.char {
+	if s == nil {
+		return nil
+	}
+
+	return C.CString(*s)
+}
+
+func GoStringPtr(ss string) *string {
+	s := ss
+	return &s
+}
+
+func GoInt64Ptr(u C.uint32_t) *int64 {
+	i := int64(u)
+	return &i
+}
+
+func GoBoolPtr(b bool) *bool {
+	p := b
+	return &p
+}
+
+func main() {
+	// main() is expected, but never executed.
+}
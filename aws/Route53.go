@@ -0,0 +1,412 @@
+package main
+
+import (
+	// #include <stdbool.h>
+	// #include <stdint.h>
+	// #include <stdlib.h>
+	// #include "dns.h"
+	"C"
+
+	"fmt"
+	"strings"
+
+	"github.com/aws/aws-sdk-go/aws"
+	"github.com/aws/aws-sdk-go/service/route53"
+)
+
+// The inputs of a job are converted to Go before the job starts: the C
+// side's memory may be gone by the time the goroutine runs.
+
+func rrSetFromRow(row *C.r53dbDNSRR) *route53.ResourceRecordSet {
+	if row == nil {
+		return nil
+	}
+
+	r53rr := route53.ResourceRecordSet{
+		Name: GoCharStringPtr(row.name),
+		Type: GoStringPtr(C.GoString(row._type)),
+	}
+
+	if row.at_dns_name == nil {
+		r53rr.TTL = GoInt64Ptr(row.ttl)
+		r53rr.ResourceRecords = []*route53.ResourceRecord{
+			&route53.ResourceRecord{
+				Value: GoCharStringPtr(row.data),
+			},
+		}
+	} else {
+		r53rr.AliasTarget = &route53.AliasTarget{
+			EvaluateTargetHealth: GoBoolPtr(bool(row.at_evaluate_target_health)),
+			DNSName: GoCharStringPtr(row.at_dns_name),
+			HostedZoneId: GoCharStringPtr(row.at_hosted_zone_id),
+		}
+	}
+
+	return &r53rr
+}
+
+// Only called from r53dbGoJobResult(), i.e. when the C side collects the
+// rows; the strings are malloc()ed.
+func rowsFromRRSet(rrset *route53.ResourceRecordSet) []C.r53dbDNSRR {
+	var rows []C.r53dbDNSRR
+
+	if rrset.AliasTarget != nil {
+		var row C.r53dbDNSRR
+		row.name = C.CString(*rrset.Name)
+		row._type = C.CString(string(*rrset.Type))
+		row.at_dns_name = C.CString(*(*rrset.AliasTarget).DNSName)
+		row.at_hosted_zone_id = C.CString(*(*rrset.AliasTarget).HostedZoneId)
+		row.at_evaluate_target_health = (C.bool) (*(*rrset.AliasTarget).EvaluateTargetHealth)
+		rows = append(rows, row)
+		return rows
+	}
+
+	for _, rr := range rrset.ResourceRecords {
+		var row C.r53dbDNSRR
+		row.name = C.CString(*rrset.Name)
+		row._type = C.CString(string(*rrset.Type))
+		row.ttl = (C.uint32_t) (int32(*rrset.TTL))
+		row.data = C.CString(*rr.Value)
+		rows = append(rows, row)
+	}
+
+	return rows
+}
+
+func getExistingRRSet(r53 *route53.Route53, rname string, rtype string, hosted_zone_id string) (*route53.ResourceRecordSet, error) {
+	if !strings.HasSuffix(rname, ".") {
+		rname += "."
+	}
+
+	lhzInput := route53.ListResourceRecordSetsInput{
+		HostedZoneId: &hosted_zone_id,
+		StartRecordName: &rname,
+		StartRecordType: &rtype,
+		MaxItems: GoStringPtr("1"),
+	}
+
+	lhzReq, lhzResp := r53.ListResourceRecordSetsRequest(&lhzInput)
+	if err := lhzReq.Send(); err != nil {
+		return nil, fmt.Errorf("ListResourceRecordSets: %s", err.Error())
+	}
+
+	if len(lhzResp.ResourceRecordSets) == 0 {
+		return nil, nil
+	}
+
+	// Route53 might return entries that are *after* what we're looking
+	// for. That means there was no match.
+
+	if *lhzResp.ResourceRecordSets[0].Name != rname {
+		return nil, nil
+	}
+
+	if *lhzResp.ResourceRecordSets[0].Type != rtype {
+		return nil, nil
+	}
+
+	return lhzResp.ResourceRecordSets[0], nil
+}
+
+func removeRRbyIndex(r []route53.ResourceRecord, index int) []route53.ResourceRecord {
+	// wtf... and also: thank you,
+	// https://stackoverflow.com/questions/37334119/how-to-delete-an-element-from-a-slice-in-golang
+	r[index] = r[len(r) - 1]
+	return r[:len(r) - 1]
+}
+
+func mergeWithExistingRRSet(
+	existingRRSet *route53.ResourceRecordSet,
+	newRow *route53.ResourceRecordSet,
+	oldRow *route53.ResourceRecordSet,
+	hosted_zone_id string,
+	op C.enum_r53dbDMLOp,
+	r *jobResult,
+) *route53.ResourceRecordSet {
+
+	// Easy path: If there's no existingRRSet, then there's nothing to merge.
+
+	if op == C.DML_INSERT {
+		if existingRRSet == nil {
+			return newRow
+		}
+	}
+
+	// First, some sanity checks (none of those statements will 'return' successfully)
+
+	if op == C.DML_INSERT {
+		if existingRRSet.AliasTarget != nil {
+			r.err = "Found existing RRSet with AliasTarget -- did you mean to UPDATE?"
+			return nil
+		}
+	}
+
+	if op == C.DML_UPDATE {
+		if *newRow.Name != *oldRow.Name {
+			r.err = "r53db: RRSet Name cannot be changed in UPDATE"
+			return nil
+		}
+
+		if *newRow.Type != *oldRow.Type {
+			r.err = "r53db: RRSet Type cannot be changed in UPDATE"
+			return nil
+		}
+	}
+
+	if op == C.DML_INSERT || op == C.DML_UPDATE {
+		if (existingRRSet.AliasTarget == nil) != (newRow.AliasTarget == nil) {
+			r.err = "Cannot modify RRSet: Inconsistent AliasTarget use in new/existing data"
+			return nil
+		}
+
+		if newRow.AliasTarget == nil {
+			if *existingRRSet.TTL == *newRow.TTL {
+				if oldRow != nil {
+					*oldRow.TTL = *newRow.TTL
+				}
+			} else {
+				r.notice = fmt.Sprintf("Rows added to an existing RRSet cannot have a different TTL; " +
+				"using the RRSet's TTL (%d) instead", *existingRRSet.TTL)
+			}
+		}
+	}
+
+	// Sanity checks ok; perform operation...
+
+	if op == C.DML_INSERT {
+		existingRRSet.ResourceRecords = append(existingRRSet.ResourceRecords, newRow.ResourceRecords[0])
+		return existingRRSet
+	}
+
+	if op == C.DML_UPDATE && existingRRSet.AliasTarget != nil {
+		existingRRSet.AliasTarget.DNSName = newRow.AliasTarget.DNSName
+		existingRRSet.AliasTarget.HostedZoneId = newRow.AliasTarget.HostedZoneId
+		existingRRSet.AliasTarget.EvaluateTargetHealth = newRow.AliasTarget.EvaluateTargetHealth
+		return existingRRSet
+	}
+
+	if op == C.DML_DELETE && existingRRSet.AliasTarget != nil {
+		oldRow.AliasTarget = nil
+		return oldRow
+	}
+
+	// If control arrives here, we're either UPDATE or DELETE, without an Alias target.
+	// We check all existing RRs, removing and/or adding the RRs from
+	// UPDATE/DELETE as appropriate.
+
+	dataToRemove := oldRow.ResourceRecords[0].Value
+
+	replacedRRs := []*route53.ResourceRecord{}
+
+	for _, r := range existingRRSet.ResourceRecords {
+		if *r.Value != *dataToRemove {
+			replacedRRs = append(replacedRRs, r)
+		}
+	}
+
+	if newRow != nil {
+		replacedRRs = append(replacedRRs, newRow.ResourceRecords[0])
+	}
+
+	oldRow.ResourceRecords = replacedRRs
+	return oldRow
+}
+
+//export r53dbGoModifyDNSRR
+func r53dbGoModifyDNSRR(conn *C.r53dbConnOptions, cid *C.char, cNewRR *C.r53dbDNSRR, cOldRR *C.r53dbDNSRR, op C.int) C.int64_t {
+	hosted_zone_id := C.GoString(cid)
+	newRow := rrSetFromRow(cNewRR)
+	oldRow := rrSetFromRow(cOldRR)
+	dmlOp := C.enum_r53dbDMLOp(op)
+
+	return startJob(connOptionsFromC(conn), func(r53 *route53.Route53, r *jobResult) {
+		var rrsName string
+		var rrsType string
+
+		if newRow != nil {
+			rrsName, rrsType = *newRow.Name, *newRow.Type
+		} else {
+			rrsName, rrsType = *oldRow.Name, *oldRow.Type
+		}
+
+		existingRRSet, err := getExistingRRSet(r53, rrsName, rrsType, hosted_zone_id)
+		if err != nil {
+			r.err = err.Error()
+			return
+		}
+
+		mergedRRSet := mergeWithExistingRRSet(existingRRSet, newRow, oldRow, hosted_zone_id, dmlOp, r)
+		if mergedRRSet == nil {
+			return
+		}
+
+		params := route53.ChangeResourceRecordSetsInput{
+			HostedZoneId: &hosted_zone_id,
+			ChangeBatch: &route53.ChangeBatch{
+				Changes: []*route53.Change{
+					&route53.Change{
+						Action: GoStringPtr("UPSERT"),
+						ResourceRecordSet: mergedRRSet,
+					},
+				},
+			},
+		}
+
+		r.debug = fmt.Sprintf("Merged RRSet for Modify operation: %v", mergedRRSet)
+
+		// Special case: if the RRSet is empty afterwards, Action will be DELETE;
+		// but we need to provide the original RRSet, because the Route53 API checks
+		// all ResourceRecords (it won't allow an empty ResourceRecords list).
+		// As a hack, we use the same logic to DELETE an AliasTarget entry.
+		if dmlOp == C.DML_DELETE && len(mergedRRSet.ResourceRecords) == 0 && mergedRRSet.AliasTarget == nil {
+			r.debug += fmt.Sprintf("\nRRSet %s is empty -- DELETEing the whole RRSet", *mergedRRSet.Name)
+			params.ChangeBatch.Changes[0].Action = GoStringPtr("DELETE")
+			params.ChangeBatch.Changes[0].ResourceRecordSet = existingRRSet
+		}
+
+		req, _ := r53.ChangeResourceRecordSetsRequest(&params)
+		if err := req.Send(); err != nil {
+			r.err = "ChangeResourceRecordSets: " + err.Error()
+			return
+		}
+
+		r.success = true
+	})
+}
+
+//export r53dbGoGetZones
+func r53dbGoGetZones(conn *C.r53dbConnOptions) C.int64_t {
+	return startJob(connOptionsFromC(conn), func(r53 *route53.Route53, r *jobResult) {
+		var marker *string = nil
+		var truncated = true
+
+		for truncated {
+			lhzReq, lhzResp := r53.ListHostedZonesRequest(&route53.ListHostedZonesInput{
+				Marker: marker,
+			})
+			if err := lhzReq.Send(); err != nil {
+				r.err = "ListHostedZones: " + err.Error()
+				return
+			}
+
+			r.zones = append(r.zones, lhzResp.HostedZones...)
+
+			truncated = *lhzResp.IsTruncated
+			marker = lhzResp.NextMarker
+		}
+
+		r.success = true
+	})
+}
+
+// Gets the Hosted Zone's current number of RRSets, or -1 if we can't get
+// at it. Used to check snapshots, so errors aren't fatal here: the caller
+// just falls back to listing the zone.
+//export r53dbGoGetRRSetCount
+func r53dbGoGetRRSetCount(conn *C.r53dbConnOptions, hosted_zone_id_c *C.char) C.int64_t {
+	hosted_zone_id := C.GoString(hosted_zone_id_c)
+
+	return startJob(connOptionsFromC(conn), func(r53 *route53.Route53, r *jobResult) {
+		r.count = -1
+
+		ghzReq, ghzResp := r53.GetHostedZoneRequest(&route53.GetHostedZoneInput{
+			Id: &hosted_zone_id,
+		})
+		if err := ghzReq.Send(); err != nil {
+			r.debug = "GetHostedZone: " + err.Error()
+			return
+		}
+
+		r.count = *ghzResp.HostedZone.ResourceRecordSetCount
+		r.success = true
+	})
+}
+
+// Route53 lists records sorted by their name with the labels reversed,
+// compared as one string: "www-2.example.com." is "com.example.www-2.",
+// which comes before "com.example.www." ('-' sorts before '.'). Escaped
+// characters (like "\052" for '*') count as what they stand for.
+func route53SortKey(name string) string {
+	labels := strings.Split(strings.TrimSuffix(strings.ToLower(name), "."), ".")
+
+	var key strings.Builder
+	for i := len(labels) - 1; i >= 0; i-- {
+		key.WriteString(unescapeRoute53Label(labels[i]))
+		key.WriteByte('.')
+	}
+
+	return key.String()
+}
+
+func unescapeRoute53Label(label string) string {
+	if !strings.Contains(label, "\\") {
+		return label
+	}
+
+	var b strings.Builder
+	for i := 0; i < len(label); i++ {
+		if label[i] == '\\' && i + 3 < len(label) && isOctal(label[i + 1]) && isOctal(label[i + 2]) && isOctal(label[i + 3]) {
+			b.WriteByte((label[i + 1] - '0') << 6 | (label[i + 2] - '0') << 3 | (label[i + 3] - '0'))
+			i += 3
+			continue
+		}
+
+		b.WriteByte(label[i])
+	}
+
+	return b.String()
+}
+
+func isOctal(c byte) bool {
+	return c >= '0' && c <= '7'
+}
+
+// Returns <0, 0 or >0, like strings.Compare(), in Route53's listing order.
+func compareRoute53Names(a string, b string) int {
+	return strings.Compare(route53SortKey(a), route53SortKey(b))
+}
+
+// List one page of RRSets, starting at the given name/type/identifier
+// (all NULL: the start of the zone) and stopping before 'stop' (NULL: the
+// end of the zone). Paging is left to the caller, so it can pace its
+// requests (see listing.c).
+//export r53dbGoListRRSets
+func r53dbGoListRRSets(conn *C.r53dbConnOptions, hosted_zone_id_c *C.char, name_c *C.char, type_c *C.char, ident_c *C.char, stop_c *C.char) C.int64_t {
+	hosted_zone_id := C.GoString(hosted_zone_id_c)
+	name := GoCharStringPtrOrNil(name_c)
+	rtype := GoCharStringPtrOrNil(type_c)
+	ident := GoCharStringPtrOrNil(ident_c)
+	stop := GoCharStringPtrOrNil(stop_c)
+
+	return startJob(connOptionsFromC(conn), func(r53 *route53.Route53, r *jobResult) {
+		rrReq, rrResp := r53.ListResourceRecordSetsRequest(&route53.ListResourceRecordSetsInput{
+			HostedZoneId: &hosted_zone_id,
+			StartRecordName: name,
+			StartRecordType: rtype,
+			StartRecordIdentifier: ident,
+			MaxItems: GoStringPtr("2"),
+		})
+
+		if err := rrReq.Send(); err != nil {
+			r.err = "r53db: ListResourceRecordSets: " + err.Error()
+			return
+		}
+
+		r.success = true
+
+		for _, rrset := range rrResp.ResourceRecordSets {
+			if stop != nil && compareRoute53Names(*rrset.Name, *stop) >= 0 {
+				return
+			}
+
+			r.rrsets = append(r.rrsets, rrset)
+			r.count++
+		}
+
+		if aws.BoolValue(rrResp.IsTruncated) {
+			r.nextName = rrResp.NextRecordName
+			r.nextType = rrResp.NextRecordType
+			r.nextIdentifier = rrResp.NextRecordIdentifier
+		}
+	})
+}
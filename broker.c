@@ -0,0 +1,1026 @@
+#include <signal.h>
+#include <stdio.h>
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+#include <pgstat.h>
+
+#include <lib/stringinfo.h>
+#include <libpq/pqformat.h>
+#include <postmaster/bgworker.h>
+#include <storage/backendid.h>
+#include <storage/dsm.h>
+#include <storage/ipc.h>
+#include <storage/latch.h>
+#include <storage/lwlock.h>
+#include <storage/proc.h>
+#include <storage/shm_mq.h>
+#include <storage/shmem.h>
+#include <storage/spin.h>
+#include <tcop/tcopprot.h>
+#include <utils/guc.h>
+#include <utils/memutils.h>
+#if PG_VERSION_NUM >= 130000
+#include <postmaster/interrupt.h>
+#endif
+
+#include "compat.h"
+#include "go_functions.h"
+#include "dns.h"
+#include "fdw.h"
+#include "broker.h"
+#include "listing.h"
+#include "ratelimit.h"
+#include "snapshot.h"
+
+/*
+ * The r53db broker is a background worker that hosts the AWS side of things
+ * (sessions, HTTP connections, response parsing) for all backends, when
+ * enabled with r53db.broker.
+ *
+ * It's started on demand by the first backend that needs it, and it's the
+ * only process that loads r53db_aws.so: Backends in broker mode never start
+ * a Go runtime.
+ *
+ * Each backend owns one slot in shared memory (indexed by its BackendId).
+ * For every request, the backend creates a DSM segment containing two
+ * shm_mqs (request and response), writes its request, then posts the
+ * segment handle in its slot and wakes up the broker.
+ *
+ * Requests are served concurrently: each one becomes a task, whose API
+ * calls run as Go jobs in the background (see go_functions.h). The main
+ * loop only ever waits on its latch and for finished jobs; it never blocks
+ * on a queue. Responses are buffered per client and sent as the backend
+ * makes room for them (which sets our latch). A zone listing
+ * that is requested while the very same listing is in flight is
+ * coalesced with it: it's only done once and sent to all waiting backends.
+ */
+
+bool r53db_use_broker = false;
+
+#define BROKER_QUEUE_SIZE 65536
+#define BROKER_SEGMENT_HEADER_SIZE MAXALIGN(sizeof(pid_t))
+#define BROKER_SEGMENT_SIZE (BROKER_SEGMENT_HEADER_SIZE + 2 * BROKER_QUEUE_SIZE)
+
+// requests (backend -> broker)
+#define BROKER_MSG_SCAN 'S'
+#define BROKER_MSG_MODIFY 'M'
+#define BROKER_MSG_ZONES 'Z'
+
+// responses (broker -> backend)
+#define BROKER_MSG_ROW 'R'
+#define BROKER_MSG_ZONE 'z'
+#define BROKER_MSG_NOTICE 'N'
+#define BROKER_MSG_ERROR 'E'
+#define BROKER_MSG_DONE 'D'
+
+typedef struct r53dbBrokerSlot {
+	pid_t pid;
+	dsm_handle handle;
+	bool pending;
+} r53dbBrokerSlot;
+
+typedef struct r53dbBrokerShared {
+	slock_t mutex;
+	pid_t broker_pid;
+	Latch *broker_latch;
+	r53dbBrokerSlot slots[FLEXIBLE_ARRAY_MEMBER];
+} r53dbBrokerShared;
+
+typedef struct r53dbBrokerClient {
+	dsm_segment *seg;
+	shm_mq_handle *request_mqh;
+	shm_mq_handle *response_mqh;
+	StringInfoData request;
+
+	List *output; // StringInfos not sent yet, the first one maybe partially
+	bool is_finished; // the whole response is in 'output' (or sent)
+	bool is_gone; // backend has detached
+} r53dbBrokerClient;
+
+// broker only: a request in progress, for one or (coalesced) more clients
+typedef struct r53dbBrokerTask {
+	MemoryContext context;
+	char type;
+	List *clients;
+	char *hosted_zone_id;
+	r53dbListing *listing; // scans
+	r53dbGoJob job; // modifications, zone lists
+} r53dbBrokerTask;
+
+static r53dbBrokerShared *broker_shared = NULL;
+
+// broker only
+static MemoryContext broker_context = NULL;
+static List *broker_tasks = NIL;
+static List *broker_clients = NIL; // attached, until their output is sent
+static pg_atomic_uint64 broker_rate_limit; // for all listings
+
+// for this backend's own listings, outside of parallel scans
+static pg_atomic_uint64 local_rate_limit;
+static bool local_rate_limit_ready = false;
+
+#if PG_VERSION_NUM < 130000
+static volatile sig_atomic_t ConfigReloadPending = false;
+
+static void SignalHandlerForConfigReload(SIGNAL_ARGS) {
+	int save_errno = errno;
+
+	ConfigReloadPending = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+#endif
+
+/*----------------
+ * message (de)serialization
+ *----------------
+ */
+
+static void send_string(StringInfo buf, const char *s) {
+	if (s == NULL) {
+		pq_sendint32(buf, -1);
+		return;
+	}
+
+	int len = strlen(s);
+	pq_sendint32(buf, len);
+	pq_sendbytes(buf, s, len);
+}
+
+static char *get_string(StringInfo msg) {
+	int32 len = (int32) pq_getmsgint(msg, 4);
+	if (len < 0) return NULL;
+
+	char *s = (char *) palloc(len + 1);
+	memcpy(s, pq_getmsgbytes(msg, len), len);
+	s[len] = '\0';
+
+	return s;
+}
+
+static void send_conn(StringInfo buf, r53dbConnOptions *conn) {
+	send_string(buf, conn->region);
+	send_string(buf, conn->endpoint);
+	send_string(buf, conn->profile);
+	send_string(buf, conn->access_key_id);
+	send_string(buf, conn->secret_access_key);
+	send_string(buf, conn->session_token);
+	send_string(buf, conn->role_arn);
+}
+
+static r53dbConnOptions *get_conn(StringInfo msg) {
+	r53dbConnOptions *conn = (r53dbConnOptions *) palloc0(sizeof(r53dbConnOptions));
+
+	conn->region = get_string(msg);
+	conn->endpoint = get_string(msg);
+	conn->profile = get_string(msg);
+	conn->access_key_id = get_string(msg);
+	conn->secret_access_key = get_string(msg);
+	conn->session_token = get_string(msg);
+	conn->role_arn = get_string(msg);
+
+	return conn;
+}
+
+static void send_rr(StringInfo buf, r53dbDNSRR *rr) {
+	pq_sendbyte(buf, rr != NULL);
+	if (rr == NULL) return;
+
+	send_string(buf, rr->name);
+	send_string(buf, rr->type);
+	pq_sendint32(buf, rr->ttl);
+	send_string(buf, rr->data);
+	send_string(buf, rr->at_dns_name);
+	send_string(buf, rr->at_hosted_zone_id);
+	pq_sendbyte(buf, rr->at_evaluate_target_health);
+}
+
+static r53dbDNSRR *get_rr(StringInfo msg) {
+	if (pq_getmsgbyte(msg) == 0) return NULL;
+
+	r53dbDNSRR *rr = (r53dbDNSRR *) palloc0(sizeof(r53dbDNSRR));
+
+	rr->name = get_string(msg);
+	rr->type = get_string(msg);
+	rr->ttl = pq_getmsgint(msg, 4);
+	rr->data = get_string(msg);
+	rr->at_dns_name = get_string(msg);
+	rr->at_hosted_zone_id = get_string(msg);
+	rr->at_evaluate_target_health = (pq_getmsgbyte(msg) != 0);
+
+	return rr;
+}
+
+/*----------------
+ * shared state
+ *----------------
+ */
+
+static Size broker_shared_size(void) {
+	return add_size(
+		offsetof(r53dbBrokerShared, slots),
+		mul_size(MaxBackends, sizeof(r53dbBrokerSlot))
+	);
+}
+
+/*
+ * As we're not in shared_preload_libraries, we cannot reserve shared memory
+ * in advance. Our struct is small enough to fit into the space that
+ * PostgreSQL keeps available for add-ins anyway.
+ */
+static void broker_attach_shared(void) {
+	bool found;
+
+	if (broker_shared != NULL) return;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	broker_shared = (r53dbBrokerShared *) ShmemInitStruct("r53db broker", broker_shared_size(), &found);
+	if (!found) {
+		memset(broker_shared, 0, broker_shared_size());
+		SpinLockInit(&broker_shared->mutex);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+static Latch *broker_get_latch(void) {
+	SpinLockAcquire(&broker_shared->mutex);
+	Latch *latch = broker_shared->broker_latch;
+	SpinLockRelease(&broker_shared->mutex);
+
+	return latch;
+}
+
+static void broker_ensure_running(void) {
+	BackgroundWorker worker;
+	BackgroundWorkerHandle *handle;
+	pid_t pid;
+
+	broker_attach_shared();
+
+	if (broker_get_latch() != NULL) return;
+
+	elog(DEBUG1, "r53db: starting broker");
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_ConsistentState;
+	worker.bgw_restart_time = BGW_NEVER_RESTART;
+	worker.bgw_notify_pid = MyProcPid;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "r53db");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "r53dbBrokerMain");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "r53db broker");
+#if PG_VERSION_NUM >= 110000
+	snprintf(worker.bgw_type, BGW_MAXLEN, "r53db broker");
+#endif
+
+	if (!RegisterDynamicBackgroundWorker(&worker, &handle)) {
+		elog(ERROR, "r53db: Cannot start broker (max_worker_processes exceeded?)");
+		return;
+	}
+
+	if (WaitForBackgroundWorkerStartup(handle, &pid) != BGWH_STARTED) {
+		elog(ERROR, "r53db: Broker failed to start");
+		return;
+	}
+
+	// If another backend started a broker at the same time, ours will
+	// exit again -- so wait for *any* broker to register itself.
+	while (broker_get_latch() == NULL) {
+		if (GetBackgroundWorkerPid(handle, &pid) == BGWH_STOPPED && broker_get_latch() == NULL) {
+			elog(ERROR, "r53db: Broker exited unexpectedly");
+			return;
+		}
+
+		(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, 10L, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+	}
+}
+
+/*----------------
+ * backend side
+ *----------------
+ */
+
+static dsm_segment *broker_send_request(StringInfo request, shm_mq_handle **response_mqh) {
+	broker_ensure_running();
+
+	dsm_segment *seg = dsm_create(BROKER_SEGMENT_SIZE, 0);
+	char *base = (char *) dsm_segment_address(seg);
+	*((pid_t *) base) = MyProcPid;
+
+	shm_mq *request_mq = shm_mq_create(base + BROKER_SEGMENT_HEADER_SIZE, BROKER_QUEUE_SIZE);
+	shm_mq *response_mq = shm_mq_create(base + BROKER_SEGMENT_HEADER_SIZE + BROKER_QUEUE_SIZE, BROKER_QUEUE_SIZE);
+	shm_mq_set_sender(request_mq, MyProc);
+	shm_mq_set_receiver(response_mq, MyProc);
+
+	shm_mq_handle *request_mqh = shm_mq_attach(request_mq, seg, NULL);
+	*response_mqh = shm_mq_attach(response_mq, seg, NULL);
+
+	// The request is complete before the broker learns about it, so it
+	// never has to wait for us.
+	if (shm_mq_send(request_mqh, request->len, request->data, true) != SHM_MQ_SUCCESS) {
+		elog(ERROR, "r53db: Request too large for broker");
+		return NULL;
+	}
+
+	r53dbBrokerSlot *slot = &broker_shared->slots[MyBackendId - 1];
+
+	SpinLockAcquire(&broker_shared->mutex);
+	slot->pid = MyProcPid;
+	slot->handle = dsm_segment_handle(seg);
+	slot->pending = true;
+	Latch *latch = broker_shared->broker_latch;
+	SpinLockRelease(&broker_shared->mutex);
+
+	if (latch == NULL) {
+		elog(ERROR, "r53db: Broker is not running");
+		return NULL;
+	}
+
+	SetLatch(latch);
+
+	return seg;
+}
+
+/*
+ * Read the broker's response until BROKER_MSG_DONE. Rows and zones are
+ * appended to *rows and *zones, notices and errors are re-raised in this
+ * backend.
+ */
+static bool broker_receive_response(shm_mq_handle *response_mqh, List **rows, List **zones) {
+	for (;;) {
+		Size nbytes;
+		void *data;
+
+		// Don't block in shm_mq_receive(): if the broker dies before
+		// attaching to our queue, we'd never notice.
+		shm_mq_result res = shm_mq_receive(response_mqh, &nbytes, &data, true);
+
+		if (res == SHM_MQ_WOULD_BLOCK) {
+			if (broker_get_latch() == NULL) {
+				elog(ERROR, "r53db: Broker is not running");
+				return false;
+			}
+
+			(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, 1000L, PG_WAIT_EXTENSION);
+			ResetLatch(MyLatch);
+			CHECK_FOR_INTERRUPTS();
+			continue;
+		}
+
+		if (res != SHM_MQ_SUCCESS) {
+			elog(ERROR, "r53db: Lost connection to broker");
+			return false;
+		}
+
+		StringInfoData msg;
+		msg.data = (char *) data;
+		msg.len = nbytes;
+		msg.maxlen = nbytes;
+		msg.cursor = 0;
+
+		char msgtype = pq_getmsgbyte(&msg);
+
+		switch (msgtype) {
+		case BROKER_MSG_ROW:
+			if (rows == NULL) {
+				elog(ERROR, "r53db: Unexpected row from broker");
+				return false;
+			}
+			*rows = lappend(*rows, get_rr(&msg));
+			break;
+		case BROKER_MSG_ZONE: {
+			if (zones == NULL) {
+				elog(ERROR, "r53db: Unexpected zone from broker");
+				return false;
+			}
+			r53dbZone *zone = (r53dbZone *) palloc0(sizeof(r53dbZone));
+			zone->id = get_string(&msg);
+			zone->name = get_string(&msg);
+			*zones = lappend(*zones, zone);
+			break;
+		}
+		case BROKER_MSG_NOTICE:
+			elog(NOTICE, "%s", get_string(&msg));
+			break;
+		case BROKER_MSG_ERROR:
+			elog(ERROR, "%s", get_string(&msg));
+			return false;
+		case BROKER_MSG_DONE:
+			return (pq_getmsgbyte(&msg) != 0);
+		default:
+			elog(ERROR, "r53db: Invalid message type %d from broker", msgtype);
+			return false;
+		}
+	}
+}
+
+static void broker_scan(r53dbScanState *scanState, char *hosted_zone_id, char *start, char *stop) {
+	StringInfoData request;
+	shm_mq_handle *response_mqh;
+
+	initStringInfo(&request);
+	pq_sendbyte(&request, BROKER_MSG_SCAN);
+	send_conn(&request, scanState->conn);
+	send_string(&request, hosted_zone_id);
+	send_string(&request, start);
+	send_string(&request, stop);
+
+	dsm_segment *seg = broker_send_request(&request, &response_mqh);
+	broker_receive_response(response_mqh, &scanState->results, NULL);
+	dsm_detach(seg);
+}
+
+static bool broker_modify(r53dbConnOptions *conn, char *hosted_zone_id, r53dbDNSRR *new_rr, r53dbDNSRR *old_rr, int op) {
+	StringInfoData request;
+	shm_mq_handle *response_mqh;
+
+	initStringInfo(&request);
+	pq_sendbyte(&request, BROKER_MSG_MODIFY);
+	send_conn(&request, conn);
+	send_string(&request, hosted_zone_id);
+	pq_sendint32(&request, op);
+	send_rr(&request, new_rr);
+	send_rr(&request, old_rr);
+
+	dsm_segment *seg = broker_send_request(&request, &response_mqh);
+	bool is_success = broker_receive_response(response_mqh, NULL, NULL);
+	dsm_detach(seg);
+
+	return is_success;
+}
+
+static List *broker_list_zones(r53dbConnOptions *conn) {
+	StringInfoData request;
+	shm_mq_handle *response_mqh;
+	List *zones = NIL;
+
+	initStringInfo(&request);
+	pq_sendbyte(&request, BROKER_MSG_ZONES);
+	send_conn(&request, conn);
+
+	dsm_segment *seg = broker_send_request(&request, &response_mqh);
+	broker_receive_response(response_mqh, NULL, &zones);
+	dsm_detach(seg);
+
+	return zones;
+}
+
+static void scan_hosted_zone_local(r53dbScanState *scanState, char *hosted_zone_id, char *start, char *stop) {
+	r53dbListing *listing = listing_begin(scanState->conn, hosted_zone_id, start, stop);
+
+	// all participants of a parallel scan share one rate limit
+	if (scanState->pstate != NULL) {
+		listing->rate_limit = &scanState->pstate->next_request_at;
+	} else {
+		if (!local_rate_limit_ready) {
+			rate_limit_init(&local_rate_limit);
+			local_rate_limit_ready = true;
+		}
+
+		listing->rate_limit = &local_rate_limit;
+	}
+
+	scanState->results = list_concat(scanState->results, listing_run(listing));
+}
+
+/*
+ * An UPDATE doesn't change the RRSet count, so snapshots can't rely on
+ * that. Instead, we invalidate them before each change (for listings that
+ * start while it's underway) and after it, successful or not (for those
+ * that started before).
+ */
+static bool modify_dns_rr_local(r53dbConnOptions *conn, char *hosted_zone_id, r53dbDNSRR *new_rr, r53dbDNSRR *old_rr, int op) {
+	snapshot_invalidate(hosted_zone_id);
+	r53dbGoJob job = go_modify_dns_rr(conn, hosted_zone_id, new_rr, old_rr, op);
+
+	PG_TRY();
+	{
+		go_wait(job);
+	}
+	PG_CATCH();
+	{
+		snapshot_invalidate(hosted_zone_id);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	snapshot_invalidate(hosted_zone_id);
+	r53dbAWSResult *result = go_job_result(job);
+
+	if (result->notice != NULL) {
+		elog(NOTICE, "%s", result->notice);
+	}
+
+	return result->success;
+}
+
+static List *list_zones_local(r53dbConnOptions *conn) {
+	r53dbGoJob job = go_get_zones(conn);
+	List *zones = NIL;
+
+	go_wait(job);
+	r53dbAWSResult *result = go_job_result(job);
+
+	for (int i = 0; i < result->nzones; i++) {
+		zones = lappend(zones, &result->zones[i]);
+	}
+
+	return zones;
+}
+
+void scan_hosted_zone(r53dbScanState *scanState, char *hosted_zone_id, char *start, char *stop) {
+	if (r53db_use_broker) {
+		broker_scan(scanState, hosted_zone_id, start, stop);
+	} else {
+		scan_hosted_zone_local(scanState, hosted_zone_id, start, stop);
+	}
+}
+
+bool modify_dns_rr(r53dbConnOptions *conn, char *hosted_zone_id, r53dbDNSRR *new_rr, r53dbDNSRR *old_rr, int op) {
+	if (r53db_use_broker) {
+		return broker_modify(conn, hosted_zone_id, new_rr, old_rr, op);
+	}
+
+	return modify_dns_rr_local(conn, hosted_zone_id, new_rr, old_rr, op);
+}
+
+List *list_zones(r53dbConnOptions *conn) {
+	if (r53db_use_broker) {
+		return broker_list_zones(conn);
+	}
+
+	return list_zones_local(conn);
+}
+
+/*----------------
+ * broker side
+ *----------------
+ */
+
+static void broker_send(r53dbBrokerClient *client, StringInfo msg) {
+	if (client->is_gone) return;
+
+	MemoryContext oldcontext = MemoryContextSwitchTo(broker_context);
+	StringInfo copy = makeStringInfo();
+	appendBinaryStringInfo(copy, msg->data, msg->len);
+	client->output = lappend(client->output, copy);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+static void broker_drop_output(r53dbBrokerClient *client) {
+	ListCell *lc;
+
+	foreach(lc, client->output) {
+		StringInfo msg = (StringInfo) lfirst(lc);
+
+		pfree(msg->data);
+		pfree(msg);
+	}
+
+	list_free(client->output);
+	client->output = NIL;
+}
+
+/*
+ * Send as much of the client's output as its queue takes right now. A
+ * message that only fit partially is continued on the next call (that's
+ * how shm_mq_send() with nowait works).
+ */
+static void broker_flush(r53dbBrokerClient *client) {
+	while (client->output != NIL) {
+		StringInfo msg = (StringInfo) linitial(client->output);
+		shm_mq_result res = shm_mq_send(client->response_mqh, msg->len, msg->data, true);
+
+		if (res == SHM_MQ_WOULD_BLOCK) return;
+
+		if (res == SHM_MQ_DETACHED) {
+			// The backend has gone away (e.g. query cancelled).
+			client->is_gone = true;
+			broker_drop_output(client);
+			return;
+		}
+
+		client->output = list_delete_first(client->output);
+		pfree(msg->data);
+		pfree(msg);
+	}
+}
+
+static void broker_send_all(r53dbBrokerTask *task, StringInfo msg) {
+	ListCell *lc;
+
+	foreach(lc, task->clients) {
+		broker_send((r53dbBrokerClient *) lfirst(lc), msg);
+	}
+}
+
+static void broker_send_done(r53dbBrokerTask *task, bool is_success) {
+	StringInfoData msg;
+
+	initStringInfo(&msg);
+	pq_sendbyte(&msg, BROKER_MSG_DONE);
+	pq_sendbyte(&msg, is_success);
+	broker_send_all(task, &msg);
+	pfree(msg.data);
+}
+
+static void broker_detach_client(r53dbBrokerClient *client) {
+	broker_drop_output(client);
+	shm_mq_detach(client->request_mqh);
+	shm_mq_detach(client->response_mqh);
+	dsm_detach(client->seg);
+	pfree(client->request.data);
+	pfree(client);
+}
+
+/*
+ * Attach to all newly posted requests and return them as a list of
+ * clients.
+ */
+static List *broker_take_pending(void) {
+	MemoryContext oldcontext = MemoryContextSwitchTo(broker_context);
+	r53dbBrokerSlot *taken = (r53dbBrokerSlot *) palloc(sizeof(r53dbBrokerSlot) * MaxBackends);
+	List *clients = NIL;
+	int ntaken = 0;
+
+	SpinLockAcquire(&broker_shared->mutex);
+	for (int i = 0; i < MaxBackends; i++) {
+		if (broker_shared->slots[i].pending) {
+			taken[ntaken++] = broker_shared->slots[i];
+			broker_shared->slots[i].pending = false;
+		}
+	}
+	SpinLockRelease(&broker_shared->mutex);
+
+	for (int i = 0; i < ntaken; i++) {
+		Size nbytes;
+		void *data;
+
+		dsm_segment *seg = dsm_attach(taken[i].handle);
+		if (seg == NULL) {
+			// backend has given up on this request already
+			continue;
+		}
+
+		char *base = (char *) dsm_segment_address(seg);
+		if (*((pid_t *) base) != taken[i].pid) {
+			// stale handle, re-used for somebody else's segment
+			dsm_detach(seg);
+			continue;
+		}
+
+		shm_mq *request_mq = (shm_mq *) (base + BROKER_SEGMENT_HEADER_SIZE);
+		shm_mq *response_mq = (shm_mq *) (base + BROKER_SEGMENT_HEADER_SIZE + BROKER_QUEUE_SIZE);
+		shm_mq_set_receiver(request_mq, MyProc);
+		shm_mq_set_sender(response_mq, MyProc);
+
+		r53dbBrokerClient *client = (r53dbBrokerClient *) palloc0(sizeof(r53dbBrokerClient));
+		client->seg = seg;
+		client->request_mqh = shm_mq_attach(request_mq, seg, NULL);
+		client->response_mqh = shm_mq_attach(response_mq, seg, NULL);
+
+		// Complete before it was posted (see broker_send_request()), so
+		// anything but success means the backend has given up.
+		if (shm_mq_receive(client->request_mqh, &nbytes, &data, true) != SHM_MQ_SUCCESS) {
+			shm_mq_detach(client->request_mqh);
+			shm_mq_detach(client->response_mqh);
+			dsm_detach(seg);
+			pfree(client);
+			continue;
+		}
+
+		initStringInfo(&client->request);
+		appendBinaryStringInfo(&client->request, (char *) data, nbytes);
+
+		clients = lappend(clients, client);
+	}
+
+	pfree(taken);
+	MemoryContextSwitchTo(oldcontext);
+
+	return clients;
+}
+
+static bool broker_same_request(r53dbBrokerClient *a, r53dbBrokerClient *b) {
+	return (a->request.len == b->request.len && memcmp(a->request.data, b->request.data, a->request.len) == 0);
+}
+
+// The task's request, positioned after the message type
+static StringInfoData broker_task_request(r53dbBrokerTask *task) {
+	StringInfoData request = ((r53dbBrokerClient *) linitial(task->clients))->request;
+
+	request.cursor = 1;
+	return request;
+}
+
+static bool broker_step_scan(r53dbBrokerTask *task) {
+	if (task->listing == NULL) {
+		StringInfoData request = broker_task_request(task);
+		r53dbConnOptions *conn = get_conn(&request);
+		task->hosted_zone_id = get_string(&request);
+		char *start = get_string(&request);
+		char *stop = get_string(&request);
+
+		task->listing = listing_begin(conn, task->hosted_zone_id, start, stop);
+		task->listing->rate_limit = &broker_rate_limit;
+	}
+
+	if (!listing_step(task->listing)) return false;
+
+	elog(DEBUG1, "r53db broker: listing of %s served to %d backend(s)", task->hosted_zone_id, list_length(task->clients));
+
+	StringInfoData msg;
+	initStringInfo(&msg);
+
+	ListCell *lc;
+	foreach(lc, task->listing->results) {
+		resetStringInfo(&msg);
+		pq_sendbyte(&msg, BROKER_MSG_ROW);
+		send_rr(&msg, (r53dbDNSRR *) lfirst(lc));
+		broker_send_all(task, &msg);
+	}
+
+	broker_send_done(task, true);
+	return true;
+}
+
+static bool broker_step_modify(r53dbBrokerTask *task) {
+	if (task->job == InvalidGoJob) {
+		StringInfoData request = broker_task_request(task);
+		r53dbConnOptions *conn = get_conn(&request);
+		task->hosted_zone_id = get_string(&request);
+		int op = pq_getmsgint(&request, 4);
+		r53dbDNSRR *new_rr = get_rr(&request);
+		r53dbDNSRR *old_rr = get_rr(&request);
+
+		// see modify_dns_rr_local()
+		snapshot_invalidate(task->hosted_zone_id);
+		task->job = go_modify_dns_rr(conn, task->hosted_zone_id, new_rr, old_rr, op);
+	}
+
+	if (!go_job_done(task->job)) return false;
+
+	r53dbGoJob job = task->job;
+	task->job = InvalidGoJob;
+	snapshot_invalidate(task->hosted_zone_id);
+	r53dbAWSResult *result = go_job_result(job);
+
+	if (result->notice != NULL) {
+		StringInfoData msg;
+
+		initStringInfo(&msg);
+		pq_sendbyte(&msg, BROKER_MSG_NOTICE);
+		send_string(&msg, result->notice);
+		broker_send_all(task, &msg);
+	}
+
+	broker_send_done(task, result->success);
+	return true;
+}
+
+static bool broker_step_zones(r53dbBrokerTask *task) {
+	if (task->job == InvalidGoJob) {
+		StringInfoData request = broker_task_request(task);
+
+		task->job = go_get_zones(get_conn(&request));
+	}
+
+	if (!go_job_done(task->job)) return false;
+
+	r53dbGoJob job = task->job;
+	task->job = InvalidGoJob;
+	r53dbAWSResult *result = go_job_result(job);
+
+	StringInfoData msg;
+	initStringInfo(&msg);
+
+	for (int i = 0; i < result->nzones; i++) {
+		resetStringInfo(&msg);
+		pq_sendbyte(&msg, BROKER_MSG_ZONE);
+		send_string(&msg, result->zones[i].id);
+		send_string(&msg, result->zones[i].name);
+		broker_send_all(task, &msg);
+	}
+
+	broker_send_done(task, true);
+	return true;
+}
+
+/*
+ * Start or advance a task, without waiting. Returns true once the task is
+ * done and all its clients have their response.
+ */
+static bool broker_step_task(r53dbBrokerTask *task) {
+	volatile bool is_done = false;
+	MemoryContext oldcontext = MemoryContextSwitchTo(task->context);
+
+	PG_TRY();
+	{
+		switch (task->type) {
+		case BROKER_MSG_SCAN:
+			is_done = broker_step_scan(task);
+			break;
+		case BROKER_MSG_MODIFY:
+			is_done = broker_step_modify(task);
+			break;
+		case BROKER_MSG_ZONES:
+			is_done = broker_step_zones(task);
+			break;
+		default:
+			elog(ERROR, "r53db broker: Invalid request type %d", task->type);
+		}
+	}
+	PG_CATCH();
+	{
+		// Errors are passed on to the backends, which re-raise them.
+		MemoryContextSwitchTo(task->context);
+		ErrorData *edata = CopyErrorData();
+		FlushErrorState();
+
+		if (task->listing != NULL) listing_cancel(task->listing);
+		go_job_forget(task->job);
+		task->job = InvalidGoJob;
+
+		StringInfoData msg;
+		initStringInfo(&msg);
+		pq_sendbyte(&msg, BROKER_MSG_ERROR);
+		send_string(&msg, edata->message);
+		broker_send_all(task, &msg);
+
+		is_done = true;
+	}
+	PG_END_TRY();
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return is_done;
+}
+
+// The clients stay around until their output has been sent.
+static void broker_finish_task(r53dbBrokerTask *task) {
+	ListCell *lc;
+
+	foreach(lc, task->clients) {
+		((r53dbBrokerClient *) lfirst(lc))->is_finished = true;
+	}
+
+	list_free(task->clients);
+	MemoryContextDelete(task->context);
+	pfree(task);
+}
+
+/*
+ * Turn a new request into a task -- or, for a listing that's already in
+ * flight, add it to that task.
+ */
+static void broker_accept(r53dbBrokerClient *client) {
+	char msgtype = client->request.data[0];
+	ListCell *lc;
+
+	if (msgtype == BROKER_MSG_SCAN) {
+		foreach(lc, broker_tasks) {
+			r53dbBrokerTask *task = (r53dbBrokerTask *) lfirst(lc);
+
+			if (task->type == BROKER_MSG_SCAN && broker_same_request(linitial(task->clients), client)) {
+				task->clients = lappend(task->clients, client);
+				return;
+			}
+		}
+	}
+
+	r53dbBrokerTask *task = (r53dbBrokerTask *) palloc0(sizeof(r53dbBrokerTask));
+	task->context = AllocSetContextCreate(broker_context, "r53db broker task", ALLOCSET_DEFAULT_SIZES);
+	task->type = msgtype;
+	task->clients = list_make1(client);
+	task->job = InvalidGoJob;
+
+	broker_tasks = lappend(broker_tasks, task);
+}
+
+/*
+ * Accept new requests, advance all tasks and send what we can. Returns how
+ * long (in ms) the broker may sleep until a rate-limited listing can go on,
+ * or -1 if only jobs or the latch can wake it up.
+ */
+static long broker_serve(void) {
+	MemoryContext oldcontext = MemoryContextSwitchTo(broker_context);
+	List *clients = broker_take_pending();
+	List *remaining = NIL;
+	long timeout = -1;
+	ListCell *lc;
+
+	foreach(lc, clients) {
+		broker_accept((r53dbBrokerClient *) lfirst(lc));
+	}
+	broker_clients = list_concat(broker_clients, clients);
+
+	foreach(lc, broker_tasks) {
+		r53dbBrokerTask *task = (r53dbBrokerTask *) lfirst(lc);
+
+		if (broker_step_task(task)) {
+			broker_finish_task(task);
+			continue;
+		}
+
+		remaining = lappend(remaining, task);
+
+		if (task->listing != NULL) {
+			long delay = listing_delay(task->listing);
+
+			if (delay >= 0 && (timeout < 0 || delay < timeout)) timeout = delay;
+		}
+	}
+
+	list_free(broker_tasks);
+	broker_tasks = remaining;
+
+	remaining = NIL;
+	foreach(lc, broker_clients) {
+		r53dbBrokerClient *client = (r53dbBrokerClient *) lfirst(lc);
+
+		broker_flush(client);
+
+		if (client->is_finished && client->output == NIL) {
+			broker_detach_client(client);
+			continue;
+		}
+
+		remaining = lappend(remaining, client);
+	}
+
+	list_free(broker_clients);
+	broker_clients = remaining;
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return timeout;
+}
+
+static void broker_unregister(int code, Datum arg) {
+	SpinLockAcquire(&broker_shared->mutex);
+	if (broker_shared->broker_pid == MyProcPid) {
+		broker_shared->broker_pid = 0;
+		broker_shared->broker_latch = NULL;
+	}
+	SpinLockRelease(&broker_shared->mutex);
+}
+
+void r53dbBrokerMain(Datum main_arg) {
+	pqsignal(SIGTERM, die);
+	pqsignal(SIGHUP, SignalHandlerForConfigReload);
+	BackgroundWorkerUnblockSignals();
+
+	broker_attach_shared();
+
+	SpinLockAcquire(&broker_shared->mutex);
+	if (broker_shared->broker_latch != NULL) {
+		// lost the race against another backend's broker
+		SpinLockRelease(&broker_shared->mutex);
+		proc_exit(0);
+	}
+	broker_shared->broker_pid = MyProcPid;
+	broker_shared->broker_latch = MyLatch;
+	SpinLockRelease(&broker_shared->mutex);
+
+	on_shmem_exit(broker_unregister, (Datum) 0);
+
+	broker_context = AllocSetContextCreate(TopMemoryContext, "r53db broker", ALLOCSET_DEFAULT_SIZES);
+	rate_limit_init(&broker_rate_limit);
+
+	// loads r53db_aws.so
+	pgsocket go_socket = go_notify_socket();
+
+	elog(LOG, "r53db broker started");
+
+	for (;;) {
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+
+		if (ConfigReloadPending) {
+			ConfigReloadPending = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		// drain first, so we can't miss a notification
+		go_drain_notify();
+		long timeout = broker_serve();
+
+		int rc = WaitLatchOrSocket(
+			MyLatch,
+			WL_LATCH_SET | WL_SOCKET_READABLE | WL_POSTMASTER_DEATH | (timeout >= 0 ? WL_TIMEOUT : 0),
+			go_socket,
+			timeout,
+			PG_WAIT_EXTENSION
+		);
+		if (rc & WL_POSTMASTER_DEATH) {
+			proc_exit(1);
+		}
+	}
+}
@@ -0,0 +1,24 @@
+#ifndef R53DB_BROKER_H
+#define R53DB_BROKER_H
+
+#include <postgres.h>
+
+#include "dns.h"
+#include "fdw.h"
+
+extern bool r53db_use_broker;
+
+/*
+ * Run a zone listing, a modification or a list of all Hosted Zones -- via
+ * the broker when r53db.broker is enabled, or within the current backend
+ * otherwise.
+ * For scans, 'start' and 'stop' limit the listing to a name range (NULL
+ * for a full listing).
+ */
+void scan_hosted_zone(r53dbScanState *scanState, char *hosted_zone_id, char *start, char *stop);
+bool modify_dns_rr(r53dbConnOptions *conn, char *hosted_zone_id, r53dbDNSRR *new_rr, r53dbDNSRR *old_rr, int op);
+List *list_zones(r53dbConnOptions *conn);
+
+PGDLLEXPORT void r53dbBrokerMain(Datum main_arg);
+
+#endif // R53DB_BROKER_H
@@ -0,0 +1,44 @@
+#ifndef R53DB_COMPAT_H
+#define R53DB_COMPAT_H
+
+#include <sys/stat.h>
+
+#include <postgres.h>
+#include <pgstat.h>
+#include <libpq/pqformat.h>
+#include <storage/fd.h>
+#include <storage/latch.h>
+#include <utils/lsyscache.h>
+
+/*
+ * r53db is written against the current PostgreSQL API; these fill the gaps
+ * for the older releases we still support (see tests/run-all-tests).
+ */
+
+#if PG_VERSION_NUM < 100000
+#define PG_WAIT_EXTENSION 0
+#define WaitLatch(latch, wakeEvents, timeout, wait_event_info) \
+	WaitLatch(latch, wakeEvents, timeout)
+#define WaitLatchOrSocket(latch, wakeEvents, sock, timeout, wait_event_info) \
+	WaitLatchOrSocket(latch, wakeEvents, sock, timeout)
+#endif
+
+#if PG_VERSION_NUM < 100000
+#define IS_JOIN_REL(rel) ((rel)->reloptkind == RELOPT_JOINREL)
+#endif
+
+#if PG_VERSION_NUM < 110000
+#define pq_sendint32(buf, i) pq_sendint(buf, i, 4)
+#define RINFO_IS_PUSHED_DOWN(rinfo, joinrelids) ((rinfo)->is_pushed_down)
+// missing attributes returned NULL rather than raising an error
+#define get_attname(relid, attnum, missing_ok) get_attname(relid, attnum)
+#define MakePGDirectory(path) mkdir(path, S_IRWXU)
+#define OpenTransientFile(path, flags) OpenTransientFile(path, flags, S_IRUSR | S_IWUSR)
+#endif
+
+#if PG_VERSION_NUM < 140000
+// string keys were the default for HASH_ELEM
+#define HASH_STRINGS 0
+#endif
+
+#endif // R53DB_COMPAT_H
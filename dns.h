@@ -1,6 +1,17 @@
 #ifndef R53DB_DNS_H
 #define R53DB_DNS_H
 
+/*
+ * Plain C types, shared with the Go library (r53db_aws.so), which doesn't
+ * know about PostgreSQL.
+ */
+
+enum r53dbDMLOp {
+	DML_INSERT,
+	DML_UPDATE,
+	DML_DELETE
+};
+
 typedef struct {
 	char *name;
 	char *type;
@@ -17,4 +28,45 @@ typedef struct {
 	char *table_name;
 } r53dbZone;
 
+/*
+ * AWS connection settings, collected from the foreign server's options
+ * and the current user's user mapping (if any). Empty fields mean "use
+ * the SDK default", i.e. the default credential chain.
+ */
+typedef struct {
+	char *region;
+	char *endpoint;
+	char *profile;
+	char *access_key_id;
+	char *secret_access_key;
+	char *session_token;
+	char *role_arn;
+} r53dbConnOptions;
+
+/*
+ * What an AWS job (see go_functions.h) returns. Everything in here is
+ * malloc()ed by Go; take it over with go_job_result().
+ */
+typedef struct {
+	char *error;
+	char *notice;
+	char *debug;
+	bool success;
+
+	// GetHostedZone: the zone's RRSet count (-1 if unknown); listings:
+	// the number of RRSets on this page
+	int64_t count;
+
+	// listings: the rows of this page, and where the next page starts
+	// (next_name is NULL after the last page)
+	int nrows;
+	r53dbDNSRR *rows;
+	char *next_name;
+	char *next_type;
+	char *next_identifier;
+
+	int nzones;
+	r53dbZone *zones;
+} r53dbAWSResult;
+
 #endif // R53DB_DNS_H
@@ -1,31 +1,107 @@
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdbool.h>
 
 #include <postgres.h>
 #include <fmgr.h>
 #include <access/htup_details.h>
+#include <access/parallel.h>
 #include <access/xact.h>
 #include <catalog/pg_type.h>
+#include <commands/explain.h>
 #include <executor/executor.h>
 #include <foreign/fdwapi.h>
 #include <foreign/foreign.h>
+#include <miscadmin.h>
 #include <nodes/makefuncs.h>
 #include <nodes/pg_list.h>
+#include <nodes/value.h>
+#include <optimizer/cost.h>
 #include <optimizer/pathnode.h>
 #include <optimizer/planmain.h>
 #include <optimizer/restrictinfo.h>
 #include <utils/builtins.h> // for TextDatumGetCString()
+#include <utils/guc.h>
+#include <utils/memutils.h>
 #include <utils/rel.h>
 #include <utils/typcache.h>
 
-#include "go_functions.h"
+#include "compat.h"
 #include "dns.h"
 #include "misc.h"
 #include "fdw.h"
+#include "broker.h"
+#include "snapshot.h"
+#include "zonestats.h"
+#include "join.h"
+#include "ratelimit.h"
 
 PG_MODULE_MAGIC;
 
+int r53db_request_latency = 100;
+
+void _PG_init(void) {
+	DefineCustomBoolVariable(
+		"r53db.broker",
+		"Run all Route53 API calls in a shared r53db broker process.",
+		NULL,
+		&r53db_use_broker,
+		false,
+		PGC_SUSET,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"r53db.snapshot_max_age",
+		"Reuse on-disk zone snapshots up to this age (-1: no limit, 0: disabled).",
+		"Snapshots are only used while the zone's RRSet count is unchanged.",
+		&r53db_snapshot_max_age,
+		0,
+		-1,
+		INT_MAX,
+		PGC_SUSET,
+		GUC_UNIT_S,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"r53db.request_latency",
+		"Typical time a Route53 API request takes, for query planning.",
+		"Parallel scans are only worth it for latencies above the rate limit of 200ms per request.",
+		&r53db_request_latency,
+		100,
+		1,
+		INT_MAX,
+		PGC_USERSET,
+		GUC_UNIT_MS,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"r53db.parallel_range_rows",
+		"Split zones into name ranges of about this many rows for parallel scans.",
+		"Takes effect with the next full listing of a zone.",
+		&r53db_parallel_range_rows,
+		1000,
+		1,
+		INT_MAX,
+		PGC_USERSET,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+}
+
 /*----------------
  * for all following functions, refer to
  * https://www.postgresql.org/docs/12/fdw-callbacks.html
@@ -37,9 +113,30 @@ void r53dbGetForeignRelSize(
 	RelOptInfo *baserel,
 	Oid foreigntableid
 ) {
-	// OPTIONAL: set estimates: baserel->rows, ->width, ->tuples
-	// This needs to exist, but doesn't really need to do anything for now.
-	elog(DEBUG1, "r53db GetForeignRelSize(): NOP");
+	elog(DEBUG1, "r53db GetForeignRelSize()");
+
+	// If we've listed this zone before (or there's a snapshot of it), we
+	// know how big it is. Otherwise, stick with the planner's defaults.
+	char *hosted_zone_id = get_relation_hosted_zone_id(foreigntableid);
+	r53dbZoneStats *stats = zone_stats_lookup(hosted_zone_id);
+	if (stats == NULL) {
+		snapshot_zone_stats(hosted_zone_id);
+		stats = zone_stats_lookup(hosted_zone_id);
+	}
+	if (stats != NULL) {
+		baserel->tuples = stats->nrows;
+		set_baserel_size_estimates(root, baserel);
+	}
+}
+
+/*
+ * Planner cost of one API request of a listing with this many participants
+ * (see R53DB_PAGE_ROWS).
+ */
+static Cost request_cost(int nparticipants) {
+	double ms = Max((double) r53db_request_latency / nparticipants, R53DB_REQUEST_INTERVAL / 1000.0);
+
+	return (Cost) (ms * R53DB_COST_PER_MS);
 }
 
 void r53dbGetForeignPaths(
@@ -49,20 +146,70 @@ void r53dbGetForeignPaths(
 ) {
 	elog(DEBUG1, "r53db GetForeignPaths()");
 
+	char *hosted_zone_id = get_relation_hosted_zone_id(foreigntableid);
+	r53dbZoneStats *stats = zone_stats_lookup(hosted_zone_id);
+	double npages = (stats != NULL) ? ceil((double) stats->nrows / R53DB_PAGE_ROWS) : 0;
+	Cost run_cost = npages * request_cost(1);
+
 	ForeignPath *fp = create_foreignscan_path(
 		root,
 		baserel,
 		NULL, // baserel->reltarget, // target
 		baserel->rows, // rows
-		(Cost) 53, // startup_cost,
-		(Cost) 53, // total_cost,
+		(Cost) R53DB_STARTUP_COST, // startup_cost,
+		(Cost) R53DB_STARTUP_COST + run_cost, // total_cost,
 		NULL, // pathkeys
 		baserel->lateral_relids, // required_outer,
 		NULL, // fdw_outerpath,
 		NULL // fdw_private
 	);
 
+	// see r53dbIsForeignScanParallelSafe()
+	fp->path.parallel_safe = false;
+
 	add_path(baserel, (Path *) fp);
+
+	/*
+	 * Parallel scan: Each participant lists one name range of the zone at a
+	 * time. The split points come from a previous full listing, so the first
+	 * scan of a zone in a session is never parallel. Neither is one that
+	 * a snapshot can serve, as ranges are always listed from Route53.
+	 */
+	if (!baserel->consider_parallel || baserel->lateral_relids != NULL) return;
+	if (stats == NULL || stats->split_points == NIL) return;
+	if (snapshot_exists(hosted_zone_id)) return;
+
+	int nworkers = Min(list_length(stats->split_points) + 1, max_parallel_workers_per_gather);
+	nworkers = Min(nworkers, R53DB_MAX_PARALLEL_WORKERS);
+	if (nworkers <= 0) return;
+
+	// the leader participates, too
+	double divisor = nworkers + 1;
+	run_cost = npages * request_cost(nworkers + 1);
+
+	List *split_points = NIL;
+	ListCell *lc;
+	foreach(lc, stats->split_points) {
+		split_points = lappend(split_points, makeString(pstrdup((char *) lfirst(lc))));
+	}
+
+	ForeignPath *pfp = create_foreignscan_path(
+		root,
+		baserel,
+		NULL, // target
+		baserel->rows / divisor, // rows (per participant)
+		(Cost) R53DB_STARTUP_COST, // startup_cost,
+		(Cost) R53DB_STARTUP_COST + run_cost, // total_cost,
+		NULL, // pathkeys
+		NULL, // required_outer,
+		NULL, // fdw_outerpath,
+		split_points // fdw_private
+	);
+
+	pfp->path.parallel_aware = true;
+	pfp->path.parallel_workers = nworkers;
+
+	add_partial_path(baserel, (Path *) pfp);
 }
 
 ForeignScan *r53dbGetForeignPlan(
@@ -76,6 +223,10 @@ ForeignScan *r53dbGetForeignPlan(
 ) {
 	elog(DEBUG1, "r53db GetForeignPlan()");
 
+	if (IS_JOIN_REL(baserel)) {
+		return get_foreign_join_plan(root, baserel, best_path, tlist, outer_plan);
+	}
+
 	return make_foreignscan(
 		tlist, // qptlist
 		extract_actual_clauses(scan_clauses, false), // qpqual
@@ -91,6 +242,11 @@ ForeignScan *r53dbGetForeignPlan(
 void r53dbBeginForeignScan(ForeignScanState *node, int eflags) {
 	elog(DEBUG1, "r53db BeginForeignScan()");
 
+	if (((ForeignScan *) node->ss.ps.plan)->scan.scanrelid == 0) {
+		begin_foreign_join_scan(node, eflags);
+		return;
+	}
+
 	r53dbScanState *scanState = (r53dbScanState *) palloc0(sizeof(r53dbScanState));
 	scanState->column_positions = NIL;
 	scanState->results = NIL;
@@ -103,14 +259,71 @@ void r53dbBeginForeignScan(ForeignScanState *node, int eflags) {
 
 	elog(DEBUG1, "BeginForeignScan of foreign table %s (hosted_zone_id %s)", relname, hosted_zone_id);
 
+	scanState->hosted_zone_id = hosted_zone_id;
 	scanState->column_positions = get_column_positions(tts->tts_tupleDescriptor);
+	scanState->conn = get_relation_connection_options(
+		node->ss.ss_currentRelation->rd_id,
+		get_rte_user_id(node->ss.ps.state, ((ForeignScan *) node->ss.ps.plan)->scan.scanrelid)
+	);
+	scanState->split_points = ((ForeignScan *) node->ss.ps.plan)->fdw_private;
+
+	if (scanState->split_points != NIL) {
+		// parallel scan: ranges are listed on demand in IterateForeignScan()
+		scanState->range_context = AllocSetContextCreate(
+			CurrentMemoryContext,
+			"r53db range scan",
+			ALLOCSET_DEFAULT_SIZES
+		);
+		return;
+	}
+
+	scan_hosted_zone(scanState, hosted_zone_id, NULL, NULL);
+	zone_stats_update(hosted_zone_id, scanState->results);
+}
 
-	r53dbGoBeginScan((void *) scanState, hosted_zone_id);
+/*
+ * Parallel scans only: Claim the next name range that nobody else has
+ * listed yet and list it. Returns false when all ranges are done.
+ */
+static bool scan_next_range(r53dbScanState *scanState) {
+	if (scanState->split_points == NIL) return false;
+
+	uint32 range;
+	if (scanState->pstate != NULL) {
+		range = pg_atomic_fetch_add_u32(&scanState->pstate->next_range, 1);
+	} else {
+		range = scanState->next_range++;
+	}
+
+	int nsplits = list_length(scanState->split_points);
+	if (range > nsplits) return false;
+
+	char *start = (range == 0) ? NULL : strVal(list_nth(scanState->split_points, range - 1));
+	char *stop = (range == nsplits) ? NULL : strVal(list_nth(scanState->split_points, range));
+
+	elog(DEBUG1, "r53db: listing range %u of %s (%s to %s)", range, scanState->hosted_zone_id,
+		start != NULL ? start : "(start)", stop != NULL ? stop : "(end)");
+
+	// We're called in per-tuple memory, so results need a home of their own.
+	MemoryContextReset(scanState->range_context);
+	MemoryContext oldcontext = MemoryContextSwitchTo(scanState->range_context);
+
+	scanState->results = NIL;
+	scanState->result_index = 0;
+	scan_hosted_zone(scanState, scanState->hosted_zone_id, start, stop);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return true;
 }
 
 TupleTableSlot *r53dbIterateForeignScan(ForeignScanState *node) {
 	elog(DEBUG1, "r53db IterateForeignScan()");
 
+	if (((ForeignScan *) node->ss.ps.plan)->scan.scanrelid == 0) {
+		return iterate_foreign_join_scan(node);
+	}
+
 	TupleTableSlot *tts = node->ss.ss_ScanTupleSlot;
 	Datum *values = tts->tts_values;
 	bool *isnull = tts->tts_isnull;
@@ -124,9 +337,11 @@ TupleTableSlot *r53dbIterateForeignScan(ForeignScanState *node) {
 
 	r53dbScanState *scanState = (r53dbScanState *) node->fdw_state;
 
-	if (scanState->result_index == list_length(scanState->results)) {
-		// done
-		return NULL;
+	while (scanState->result_index == list_length(scanState->results)) {
+		if (!scan_next_range(scanState)) {
+			// done
+			return NULL;
+		}
 	}
 
 	r53dbDNSRR *rr = (r53dbDNSRR *) list_nth(scanState->results, scanState->result_index);
@@ -145,38 +360,7 @@ TupleTableSlot *r53dbIterateForeignScan(ForeignScanState *node) {
 	foreach(lc, scanState->column_positions) {
 		r53dbColumnPosition *cp = (r53dbColumnPosition *) lfirst(lc);
 
-		switch (cp->column) {
-		case name:
-			values[cp->position] = CStringGetTextDatum(rr->name);
-			isnull[cp->position] = false;
-			break;
-		case type:
-			values[cp->position] = CStringGetTextDatum(rr->type);
-			isnull[cp->position] = false;
-			break;
-		case ttl:
-			values[cp->position] = Int32GetDatum(rr->ttl);
-			isnull[cp->position] = (rr->at_dns_name != NULL);
-			break;
-		case data:
-			values[cp->position] = CStringGetTextDatumOrNULL(rr->data);
-			isnull[cp->position] = (rr->at_dns_name != NULL);
-			break;
-		case at_dns_name:
-			values[cp->position] = CStringGetTextDatumOrNULL(rr->at_dns_name);
-			isnull[cp->position] = (rr->at_dns_name == NULL);
-			break;
-		case at_hosted_zone_id:
-			values[cp->position] = CStringGetTextDatumOrNULL(rr->at_hosted_zone_id);
-			isnull[cp->position] = (rr->at_dns_name == NULL);
-			break;
-		case at_evaluate_target_health:
-			values[cp->position] = BoolGetDatum(rr->at_evaluate_target_health);
-			isnull[cp->position] = (rr->at_dns_name == NULL);
-			break;
-		default:
-			elog(ERROR, "Internal error: Invalid column %d in column list", cp->column);
-		}
+		get_column_value(rr, cp->column, &values[cp->position], &isnull[cp->position]);
 	}
 
 	ExecStoreVirtualTuple(tts);
@@ -185,19 +369,78 @@ TupleTableSlot *r53dbIterateForeignScan(ForeignScanState *node) {
 }
 
 void r53dbReScanForeignScan(ForeignScanState *node) {
-	elog(ERROR, "r53db: ReScanForeignScan not yet implemented");
+	elog(DEBUG1, "r53db ReScanForeignScan()");
+
+	if (((ForeignScan *) node->ss.ps.plan)->scan.scanrelid == 0) {
+		rescan_foreign_join_scan(node);
+		return;
+	}
+
+	r53dbScanState *scanState = (r53dbScanState *) node->fdw_state;
+
+	scanState->result_index = 0;
+
+	if (scanState->split_points != NIL) {
+		// Parallel scan: start over with the first range. The shared
+		// counter is reset in ReInitializeDSMForeignScan().
+		scanState->results = NIL;
+		scanState->next_range = 0;
+	}
+}
+
+/*
+ * Only the parallel-aware scan really is parallel safe: the plain one would
+ * list the whole zone in every worker. GetForeignPaths() marks it unsafe.
+ */
+bool r53dbIsForeignScanParallelSafe(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte) {
+	return true;
+}
+
+Size r53dbEstimateDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt) {
+	return sizeof(r53dbParallelState);
+}
+
+void r53dbInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt, void *coordinate) {
+	elog(DEBUG1, "r53db InitializeDSMForeignScan()");
+
+	r53dbScanState *scanState = (r53dbScanState *) node->fdw_state;
+	scanState->pstate = (r53dbParallelState *) coordinate;
+	pg_atomic_init_u32(&scanState->pstate->next_range, 0);
+	rate_limit_init(&scanState->pstate->next_request_at);
+}
+
+#if PG_VERSION_NUM >= 100000
+void r53dbReInitializeDSMForeignScan(ForeignScanState *node, ParallelContext *pcxt, void *coordinate) {
+	elog(DEBUG1, "r53db ReInitializeDSMForeignScan()");
+
+	r53dbParallelState *pstate = (r53dbParallelState *) coordinate;
+	pg_atomic_write_u32(&pstate->next_range, 0);
+}
+#endif
+
+void r53dbInitializeWorkerForeignScan(ForeignScanState *node, shm_toc *toc, void *coordinate) {
+	elog(DEBUG1, "r53db InitializeWorkerForeignScan()");
+
+	r53dbScanState *scanState = (r53dbScanState *) node->fdw_state;
+	scanState->pstate = (r53dbParallelState *) coordinate;
 }
 
 void r53dbEndForeignScan(ForeignScanState *node) {
 	elog(DEBUG1, "r53db EndForeignScan()");
-	r53dbGoEndScan();
+}
+
+void r53dbExplainForeignScan(ForeignScanState *node, ExplainState *es) {
+	if (((ForeignScan *) node->ss.ps.plan)->scan.scanrelid == 0) {
+		explain_foreign_join_scan(node, es);
+	}
 }
 
 List *r53dbImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid) {
 	elog(DEBUG1, "r53db ImportForeignSchema()");
 
 	ForeignServer *fs = GetForeignServer(serverOid);
-	List *zones = (List *) r53dbGoGetZones(NULL);
+	r53dbConnOptions *conn = get_connection_options(serverOid, GetUserId());
+	List *zones = list_zones(conn);
 	elog(DEBUG2, "... zoneList@%p", zones);
 	elog(DEBUG2, "... serverName@%p", fs->servername);
 
@@ -207,6 +450,9 @@ List *r53dbImportForeignSchema(ImportForeignSchemaStmt *stmt, Oid serverOid) {
 		r53dbZone *zone = (r53dbZone *) lfirst(lc);
 		elog(DEBUG2, "... zoneName@%p zoneId@%p", zone->name, zone->id);
 
+		zone->table_name = pstrdup(zone->name);
+		make_dns_identifier(zone->table_name);
+
 		char *statement = psprintf(
 			"CREATE FOREIGN TABLE IF NOT EXISTS %s ("
 				"name text not null, "
@@ -259,6 +505,10 @@ void r53dbBeginForeignModify(
 
 	modifyState->operation = mtstate->operation;
 	modifyState->hosted_zone_id = get_relation_hosted_zone_id(rinfo->ri_RelationDesc->rd_id);
+	modifyState->conn = get_relation_connection_options(
+		rinfo->ri_RelationDesc->rd_id,
+		get_rte_user_id(mtstate->ps.state, rinfo->ri_RangeTableIndex)
+	);
 	modifyState->column_positions = get_column_positions(rinfo->ri_RelationDesc->rd_att);
 
 	if (mtstate->operation != CMD_INSERT) {
@@ -353,13 +603,13 @@ TupleTableSlot *r53dbExecForeignModify(
 	bool is_success = false;
 	switch (modifyState->operation) {
 	case CMD_INSERT:
-		is_success = r53dbGoModifyDNSRR(modifyState->hosted_zone_id, newRR, oldRR, DML_INSERT);
+		is_success = modify_dns_rr(modifyState->conn, modifyState->hosted_zone_id, newRR, oldRR, DML_INSERT);
 		break;
 	case CMD_UPDATE:
-		is_success = r53dbGoModifyDNSRR(modifyState->hosted_zone_id, newRR, oldRR, DML_UPDATE);
+		is_success = modify_dns_rr(modifyState->conn, modifyState->hosted_zone_id, newRR, oldRR, DML_UPDATE);
 		break;
 	case CMD_DELETE:
-		is_success = r53dbGoModifyDNSRR(modifyState->hosted_zone_id, newRR, oldRR, DML_DELETE);
+		is_success = modify_dns_rr(modifyState->conn, modifyState->hosted_zone_id, newRR, oldRR, DML_DELETE);
 		if (is_success) {
 			// fill the passed-in 'slot' with the tuple to be returned
 			ExecClearTuple(slot);
@@ -382,15 +632,23 @@ Datum r53db_fdw_handler(PG_FUNCTION_ARGS) {
 	FdwRoutine *fdw = makeNode(FdwRoutine);
 
 	elog(DEBUG1, "r53db says hi!");
-	r53dbGoOnLoad();
 
 	fdw->GetForeignRelSize = r53dbGetForeignRelSize;
 	fdw->GetForeignPaths = r53dbGetForeignPaths;
 	fdw->GetForeignPlan = r53dbGetForeignPlan;
+	fdw->GetForeignJoinPaths = r53dbGetForeignJoinPaths;
 	fdw->BeginForeignScan = r53dbBeginForeignScan;
 	fdw->IterateForeignScan = r53dbIterateForeignScan;
 	fdw->ReScanForeignScan = r53dbReScanForeignScan;
 	fdw->EndForeignScan = r53dbEndForeignScan;
+	fdw->ExplainForeignScan = r53dbExplainForeignScan;
+	fdw->IsForeignScanParallelSafe = r53dbIsForeignScanParallelSafe;
+	fdw->EstimateDSMForeignScan = r53dbEstimateDSMForeignScan;
+	fdw->InitializeDSMForeignScan = r53dbInitializeDSMForeignScan;
+#if PG_VERSION_NUM >= 100000
+	fdw->ReInitializeDSMForeignScan = r53dbReInitializeDSMForeignScan;
+#endif
+	fdw->InitializeWorkerForeignScan = r53dbInitializeWorkerForeignScan;
 	fdw->ImportForeignSchema = r53dbImportForeignSchema;
 	fdw->BeginForeignModify = r53dbBeginForeignModify;
 	fdw->ExecForeignInsert = r53dbExecForeignModify;
@@ -3,12 +3,9 @@
 
 #include <postgres.h>
 #include <nodes/pg_list.h>
+#include <port/atomics.h>
 
-enum r53dbDMLOp {
-	DML_INSERT,
-	DML_UPDATE,
-	DML_DELETE
-};
+#include "dns.h"
 
 enum r53dbColumn {
 	name,
@@ -25,17 +22,51 @@ typedef struct r53dbColumnPosition {
 	uint32_t position;
 } r53dbColumnPosition;
 
+/*
+ * Cost of listing a zone: Route53 returns at most R53DB_PAGE_ROWS RRSets
+ * per API call (see r53dbGoListRRSets()), so it's all about the number of
+ * requests. Each one takes r53db.request_latency, but no listing gets more
+ * than one request per rate limit slot (see ratelimit.h) -- no matter how
+ * many participants share the round trips.
+ */
+#define R53DB_STARTUP_COST 53
+#define R53DB_PAGE_ROWS 2
+#define R53DB_COST_PER_MS 0.02
+
+extern int r53db_request_latency;
+
+/*
+ * Route53 allows only five API requests per second per account, and all
+ * participants of a parallel scan share that (see ratelimit.h) -- more
+ * workers than that just wait for their turn.
+ */
+#define R53DB_MAX_PARALLEL_WORKERS 4
+
+typedef struct r53dbParallelState {
+	pg_atomic_uint32 next_range;
+	pg_atomic_uint64 next_request_at;
+} r53dbParallelState;
+
 typedef struct r53dbScanState {
 	char *hosted_zone_id;
+	r53dbConnOptions *conn;
 	List *column_positions;
 	List *results;
 	int result_index;
+
+	// parallel scans only: ranges are handed out through pstate, or
+	// through next_range if no DSM has been set up (no workers)
+	List *split_points;
+	r53dbParallelState *pstate;
+	uint32 next_range;
+	MemoryContext range_context;
 } r53dbScanState;
 
 typedef struct r53dbModifyState {
 	int junk_row_resno;
 	int operation;
 	char *hosted_zone_id;
+	r53dbConnOptions *conn;
 	List *column_positions;
 } r53dbModifyState;
 
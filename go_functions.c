@@ -0,0 +1,234 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+#include <pgstat.h>
+
+#include <storage/ipc.h>
+#include <storage/latch.h>
+
+#include "compat.h"
+#include "dns.h"
+#include "go_functions.h"
+#include "misc.h"
+
+#define R53DB_AWS_LIBRARY "$libdir/r53db_aws"
+
+// exported by aws/*.go
+typedef void (*r53dbGoInitFn)(int notify_fd);
+typedef bool (*r53dbGoJobDoneFn)(int64_t job);
+typedef void (*r53dbGoJobForgetFn)(int64_t job);
+typedef void (*r53dbGoJobResultFn)(int64_t job, r53dbAWSResult *result);
+typedef int64_t (*r53dbGoListRRSetsFn)(r53dbConnOptions *conn, char *hosted_zone_id, char *name, char *type, char *identifier, char *stop);
+typedef int64_t (*r53dbGoGetRRSetCountFn)(r53dbConnOptions *conn, char *hosted_zone_id);
+typedef int64_t (*r53dbGoModifyDNSRRFn)(r53dbConnOptions *conn, char *hosted_zone_id, r53dbDNSRR *new_rr, r53dbDNSRR *old_rr, int op);
+typedef int64_t (*r53dbGoGetZonesFn)(r53dbConnOptions *conn);
+
+static r53dbGoJobDoneFn r53dbGoJobDone = NULL;
+static r53dbGoJobForgetFn r53dbGoJobForget = NULL;
+static r53dbGoJobResultFn r53dbGoJobResult = NULL;
+static r53dbGoListRRSetsFn r53dbGoListRRSets = NULL;
+static r53dbGoGetRRSetCountFn r53dbGoGetRRSetCount = NULL;
+static r53dbGoModifyDNSRRFn r53dbGoModifyDNSRR = NULL;
+static r53dbGoGetZonesFn r53dbGoGetZones = NULL;
+
+// Finished jobs write a byte to this pipe
+static int go_notify_pipe[2] = {-1, -1};
+
+static void *go_lookup(const char *name) {
+	return (void *) load_external_function(R53DB_AWS_LIBRARY, (char *) name, true, NULL);
+}
+
+static void go_load(void) {
+	if (go_notify_pipe[0] >= 0) return;
+
+	r53dbGoInitFn r53dbGoInit = (r53dbGoInitFn) go_lookup("r53dbGoInit");
+	r53dbGoJobDone = (r53dbGoJobDoneFn) go_lookup("r53dbGoJobDone");
+	r53dbGoJobForget = (r53dbGoJobForgetFn) go_lookup("r53dbGoJobForget");
+	r53dbGoJobResult = (r53dbGoJobResultFn) go_lookup("r53dbGoJobResult");
+	r53dbGoListRRSets = (r53dbGoListRRSetsFn) go_lookup("r53dbGoListRRSets");
+	r53dbGoGetRRSetCount = (r53dbGoGetRRSetCountFn) go_lookup("r53dbGoGetRRSetCount");
+	r53dbGoModifyDNSRR = (r53dbGoModifyDNSRRFn) go_lookup("r53dbGoModifyDNSRR");
+	r53dbGoGetZones = (r53dbGoGetZonesFn) go_lookup("r53dbGoGetZones");
+
+	int fds[2];
+	if (pipe(fds) < 0) {
+		elog(ERROR, "r53db: could not create pipe: %m");
+		return;
+	}
+
+	for (int i = 0; i < 2; i++) {
+		if (fcntl(fds[i], F_SETFL, O_NONBLOCK) < 0 || fcntl(fds[i], F_SETFD, FD_CLOEXEC) < 0) {
+			elog(ERROR, "r53db: could not set up pipe: %m");
+			return;
+		}
+	}
+
+	r53dbGoInit(fds[1]);
+
+	go_notify_pipe[0] = fds[0];
+	go_notify_pipe[1] = fds[1];
+
+	elog(DEBUG1, "r53db: loaded %s", R53DB_AWS_LIBRARY);
+}
+
+pgsocket go_notify_socket(void) {
+	go_load();
+
+	return go_notify_pipe[0];
+}
+
+void go_drain_notify(void) {
+	char buf[64];
+
+	if (go_notify_pipe[0] < 0) return;
+
+	while (read(go_notify_pipe[0], buf, sizeof(buf)) > 0) {
+		// nothing
+	}
+}
+
+bool go_job_done(r53dbGoJob job) {
+	go_load();
+
+	return r53dbGoJobDone(job);
+}
+
+void go_job_forget(r53dbGoJob job) {
+	if (job == InvalidGoJob) return;
+
+	go_load();
+	r53dbGoJobForget(job);
+}
+
+/*
+ * Wait until the job is done. If we're interrupted, nobody will pick up
+ * the result, so the job is forgotten.
+ */
+void go_wait(r53dbGoJob job) {
+	pgsocket sock = go_notify_socket();
+
+	PG_TRY();
+	{
+		for (;;) {
+			// drain first, so we can't miss a notification
+			go_drain_notify();
+
+			if (go_job_done(job)) break;
+
+			int rc = WaitLatchOrSocket(
+				MyLatch,
+				WL_LATCH_SET | WL_SOCKET_READABLE | WL_POSTMASTER_DEATH,
+				sock,
+				-1L,
+				PG_WAIT_EXTENSION
+			);
+			if (rc & WL_POSTMASTER_DEATH) {
+				proc_exit(1);
+			}
+
+			ResetLatch(MyLatch);
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+	PG_CATCH();
+	{
+		go_job_forget(job);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+}
+
+static void palloc_rr(r53dbDNSRR *rr) {
+	palloc_string(&rr->name);
+	palloc_string(&rr->type);
+	palloc_string(&rr->data);
+	palloc_string(&rr->at_dns_name);
+	palloc_string(&rr->at_hosted_zone_id);
+}
+
+static void palloc_zone(r53dbZone *zone) {
+	palloc_string(&zone->id);
+	palloc_string(&zone->name);
+	palloc_string(&zone->table_name);
+}
+
+/*
+ * Collect the result of a finished job, in CurrentMemoryContext. Errors
+ * are raised right here; notices are left to the caller, as the broker
+ * needs to pass them on.
+ */
+r53dbAWSResult *go_job_result(r53dbGoJob job) {
+	r53dbAWSResult *result = (r53dbAWSResult *) palloc0(sizeof(r53dbAWSResult));
+
+	go_load();
+	r53dbGoJobResult(job, result);
+
+	palloc_string(&result->error);
+	palloc_string(&result->notice);
+	palloc_string(&result->debug);
+	palloc_string(&result->next_name);
+	palloc_string(&result->next_type);
+	palloc_string(&result->next_identifier);
+
+	if (result->nrows > 0) {
+		r53dbDNSRR *rows = result->rows;
+
+		result->rows = (r53dbDNSRR *) palloc(sizeof(r53dbDNSRR) * result->nrows);
+		memcpy(result->rows, rows, sizeof(r53dbDNSRR) * result->nrows);
+		free(rows);
+
+		for (int i = 0; i < result->nrows; i++) {
+			palloc_rr(&result->rows[i]);
+		}
+	}
+
+	if (result->nzones > 0) {
+		r53dbZone *zones = result->zones;
+
+		result->zones = (r53dbZone *) palloc(sizeof(r53dbZone) * result->nzones);
+		memcpy(result->zones, zones, sizeof(r53dbZone) * result->nzones);
+		free(zones);
+
+		for (int i = 0; i < result->nzones; i++) {
+			palloc_zone(&result->zones[i]);
+		}
+	}
+
+	if (result->debug != NULL) {
+		elog(DEBUG1, "%s", result->debug);
+	}
+
+	if (result->error != NULL) {
+		elog(ERROR, "%s", result->error);
+	}
+
+	return result;
+}
+
+r53dbGoJob go_list_rrsets(r53dbConnOptions *conn, char *hosted_zone_id, char *name, char *type, char *identifier, char *stop) {
+	go_load();
+
+	return r53dbGoListRRSets(conn, hosted_zone_id, name, type, identifier, stop);
+}
+
+r53dbGoJob go_get_rrset_count(r53dbConnOptions *conn, char *hosted_zone_id) {
+	go_load();
+
+	return r53dbGoGetRRSetCount(conn, hosted_zone_id);
+}
+
+r53dbGoJob go_modify_dns_rr(r53dbConnOptions *conn, char *hosted_zone_id, r53dbDNSRR *new_rr, r53dbDNSRR *old_rr, int op) {
+	go_load();
+
+	return r53dbGoModifyDNSRR(conn, hosted_zone_id, new_rr, old_rr, op);
+}
+
+r53dbGoJob go_get_zones(r53dbConnOptions *conn) {
+	go_load();
+
+	return r53dbGoGetZones(conn);
+}
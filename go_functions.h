@@ -1,13 +1,36 @@
 #ifndef R53DB_GOFUNC_H
 #define R53DB_GOFUNC_H
 
+#include <postgres.h>
+
 #include "dns.h"
 
-extern void r53dbGoOnLoad();
-extern bool r53dbGoModifyDNSRR(char *hosted_zone_id, r53dbDNSRR *new_rr, r53dbDNSRR *old_rr, int op);
-extern char *r53dbGoGetZones(char *zoneList);
-extern void r53dbGoBeginScan(char *scanState, const char *hosted_zone_id);
-extern void r53dbGoEndScan();
-extern r53dbDNSRR *r53dbGoIterateScan();
+/*
+ * The AWS side of r53db lives in a separate library, r53db_aws.so (see
+ * aws/). It's loaded -- and the Go runtime started -- by the first call in
+ * a process, so backends that leave all API calls to the broker never
+ * carry a Go runtime.
+ *
+ * Every call starts a job that runs in the background; its result is
+ * collected with go_job_result() once go_job_done() says so. Wait for
+ * jobs by waiting for go_notify_socket() to become readable, or with
+ * go_wait().
+ */
+typedef int64 r53dbGoJob;
+
+#define InvalidGoJob ((r53dbGoJob) 0)
+
+pgsocket go_notify_socket(void);
+void go_drain_notify(void);
+
+bool go_job_done(r53dbGoJob job);
+void go_job_forget(r53dbGoJob job);
+void go_wait(r53dbGoJob job);
+r53dbAWSResult *go_job_result(r53dbGoJob job);
+
+r53dbGoJob go_list_rrsets(r53dbConnOptions *conn, char *hosted_zone_id, char *name, char *type, char *identifier, char *stop);
+r53dbGoJob go_get_rrset_count(r53dbConnOptions *conn, char *hosted_zone_id);
+r53dbGoJob go_modify_dns_rr(r53dbConnOptions *conn, char *hosted_zone_id, r53dbDNSRR *new_rr, r53dbDNSRR *old_rr, int op);
+r53dbGoJob go_get_zones(r53dbConnOptions *conn);
 
 #endif // R53DB_GOFUNC_H
@@ -0,0 +1,526 @@
+#include <stdio.h>
+
+#include <postgres.h>
+#include <fmgr.h>
+#include <catalog/pg_collation.h>
+#include <catalog/pg_operator.h>
+#include <commands/explain.h>
+#include <executor/executor.h>
+#include <foreign/fdwapi.h>
+#include <lib/stringinfo.h>
+#include <nodes/makefuncs.h>
+#include <nodes/pg_list.h>
+#include <nodes/value.h>
+#include <optimizer/cost.h>
+#include <optimizer/pathnode.h>
+#include <optimizer/planmain.h>
+#include <optimizer/tlist.h>
+#include <parser/parsetree.h>
+#if PG_VERSION_NUM >= 120000
+#include <optimizer/optimizer.h> // for pull_var_clause()
+#else
+#include <optimizer/var.h>
+#endif
+#include <utils/builtins.h> // for quote_identifier()
+#if PG_VERSION_NUM >= 130000
+#include <common/hashfn.h> // for tag_hash()
+#else
+#include <utils/hsearch.h> // for tag_hash()
+#endif
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+
+#include "compat.h"
+#include "dns.h"
+#include "misc.h"
+#include "fdw.h"
+#include "broker.h"
+#include "zonestats.h"
+#include "join.h"
+
+/*
+ * Join pushdown: An equi-join between two r53db tables (e.g. at_dns_name
+ * of one zone against name of another) is run as a single ForeignScan,
+ * which lists both zones and does a hash join on the listed records.
+ * Only joined rows are turned into tuples.
+ *
+ * We support inner and left joins of two base relations, on text columns
+ * only. Any other conditions are checked on the joined rows.
+ */
+
+#define JOIN_SIDE_OUTER 0
+#define JOIN_SIDE_INNER 1
+
+// planner only; lives in joinrel->fdw_private
+typedef struct r53dbJoinInfo {
+	JoinType jointype;
+	Index outer_rti;
+	Index inner_rti;
+	List *join_keys; // int list: outer column, inner column, ...
+	List *local_conds; // Expr nodes
+} r53dbJoinInfo;
+
+typedef struct r53dbJoinEntry {
+	uint32 hash;
+	char *key;
+	int keylen;
+	r53dbDNSRR *rr;
+} r53dbJoinEntry;
+
+typedef struct r53dbJoinScanState {
+	JoinType jointype;
+	List *join_keys; // int list: outer column, inner column, ...
+	List *columns; // int list: side, column for each column in fdw_scan_tlist
+
+	r53dbScanState *outer;
+	r53dbScanState *inner;
+
+	// hash table over the inner side's records
+	List **buckets;
+	uint32 nbuckets;
+
+	int outer_index;
+	r53dbDNSRR *outer_rr;
+	List *matches;
+	int match_index;
+	bool emit_unmatched;
+
+	StringInfoData key;
+	MemoryContext probe_context;
+} r53dbJoinScanState;
+
+/*----------------
+ * planner side
+ *----------------
+ */
+
+static bool get_var_column(PlannerInfo *root, Var *var, enum r53dbColumn *column) {
+	Oid atttypid;
+
+	if (var->varlevelsup != 0 || var->varattno <= 0) {
+		// whole-row references and system columns are not supported
+		return false;
+	}
+
+	RangeTblEntry *rte = planner_rt_fetch(var->varno, root);
+	char *attname = get_attname(rte->relid, var->varattno, false);
+
+	return get_column_by_name(attname, column, &atttypid);
+}
+
+/*
+ * Is this clause "outer_column = inner_column", with text columns from
+ * both sides?
+ */
+static bool get_join_key(
+	PlannerInfo *root,
+	r53dbJoinInfo *jinfo,
+	Expr *clause,
+	enum r53dbColumn *outer_column,
+	enum r53dbColumn *inner_column
+) {
+	if (!IsA(clause, OpExpr)) return false;
+
+	OpExpr *op = (OpExpr *) clause;
+	if (op->opno != TextEqualOperator || list_length(op->args) != 2) return false;
+
+	// We compare bytes, which is only right for deterministic collations.
+	if (op->inputcollid != DEFAULT_COLLATION_OID && op->inputcollid != C_COLLATION_OID) return false;
+
+	Var *outer_var = (Var *) linitial(op->args);
+	Var *inner_var = (Var *) lsecond(op->args);
+	if (!IsA(outer_var, Var) || !IsA(inner_var, Var)) return false;
+
+	if (outer_var->varno == jinfo->inner_rti) {
+		Var *tmp = outer_var;
+		outer_var = inner_var;
+		inner_var = tmp;
+	}
+
+	if (outer_var->varno != jinfo->outer_rti || inner_var->varno != jinfo->inner_rti) return false;
+
+	return (get_var_column(root, outer_var, outer_column) && get_var_column(root, inner_var, inner_column));
+}
+
+static r53dbJoinInfo *get_join_info(
+	PlannerInfo *root,
+	RelOptInfo *joinrel,
+	RelOptInfo *outerrel,
+	RelOptInfo *innerrel,
+	JoinType jointype,
+	JoinPathExtraData *extra
+) {
+	// no EvalPlanQual rechecks, please
+	if (root->parse->commandType != CMD_SELECT || root->rowMarks != NIL) return NULL;
+
+	if (jointype != JOIN_INNER && jointype != JOIN_LEFT) return NULL;
+	if (outerrel->reloptkind != RELOPT_BASEREL || innerrel->reloptkind != RELOPT_BASEREL) return NULL;
+	if (joinrel->lateral_relids != NULL) return NULL;
+
+	// Both zones are listed with the same user mapping.
+	if (planner_rt_fetch(outerrel->relid, root)->checkAsUser != planner_rt_fetch(innerrel->relid, root)->checkAsUser) {
+		return NULL;
+	}
+
+	// For left joins, the inner side would have to be filtered *before*
+	// joining. Keep it simple and let PostgreSQL do that instead.
+	if (jointype == JOIN_LEFT && innerrel->baserestrictinfo != NIL) return NULL;
+
+	r53dbJoinInfo *jinfo = (r53dbJoinInfo *) palloc0(sizeof(r53dbJoinInfo));
+	jinfo->jointype = jointype;
+	jinfo->outer_rti = outerrel->relid;
+	jinfo->inner_rti = innerrel->relid;
+
+	ListCell *lc;
+	foreach(lc, extra->restrictlist) {
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		enum r53dbColumn outer_column, inner_column;
+
+		// WHERE clauses above an outer join are just filters on its result
+		bool is_join_cond = !(IS_OUTER_JOIN(jointype) && RINFO_IS_PUSHED_DOWN(rinfo, joinrel->relids));
+
+		if (is_join_cond && get_join_key(root, jinfo, rinfo->clause, &outer_column, &inner_column)) {
+			jinfo->join_keys = lappend_int(jinfo->join_keys, outer_column);
+			jinfo->join_keys = lappend_int(jinfo->join_keys, inner_column);
+			continue;
+		}
+
+		if (IS_OUTER_JOIN(jointype) && is_join_cond) {
+			// can't be checked on the joined rows
+			return NULL;
+		}
+
+		jinfo->local_conds = lappend(jinfo->local_conds, rinfo->clause);
+	}
+
+	if (jinfo->join_keys == NIL) return NULL;
+
+	foreach(lc, outerrel->baserestrictinfo) {
+		jinfo->local_conds = lappend(jinfo->local_conds, ((RestrictInfo *) lfirst(lc))->clause);
+	}
+
+	foreach(lc, innerrel->baserestrictinfo) {
+		jinfo->local_conds = lappend(jinfo->local_conds, ((RestrictInfo *) lfirst(lc))->clause);
+	}
+
+	// Every column we return (or check locally) must be a plain r53db column.
+	foreach(lc, joinrel->reltarget->exprs) {
+		enum r53dbColumn column;
+		Var *var = (Var *) lfirst(lc);
+
+		if (!IsA(var, Var) || !get_var_column(root, var, &column)) return NULL;
+	}
+
+	List *vars = pull_var_clause((Node *) jinfo->local_conds, PVC_RECURSE_PLACEHOLDERS);
+	foreach(lc, vars) {
+		enum r53dbColumn column;
+
+		if (!get_var_column(root, (Var *) lfirst(lc), &column)) return NULL;
+	}
+
+	return jinfo;
+}
+
+void r53dbGetForeignJoinPaths(
+	PlannerInfo *root,
+	RelOptInfo *joinrel,
+	RelOptInfo *outerrel,
+	RelOptInfo *innerrel,
+	JoinType jointype,
+	JoinPathExtraData *extra
+) {
+	elog(DEBUG1, "r53db GetForeignJoinPaths()");
+
+	// We're called for each join order; the first one we accept will do.
+	if (joinrel->fdw_private != NULL) return;
+
+	r53dbJoinInfo *jinfo = get_join_info(root, joinrel, outerrel, innerrel, jointype, extra);
+	if (jinfo == NULL) return;
+
+	joinrel->fdw_private = jinfo;
+
+	// Both zones are listed completely before the first row is returned.
+	Cost startup_cost = outerrel->cheapest_total_path->total_cost + innerrel->cheapest_total_path->total_cost;
+	Cost total_cost = startup_cost + cpu_tuple_cost * joinrel->rows;
+
+#if PG_VERSION_NUM >= 120000
+	ForeignPath *fp = create_foreign_join_path(
+#else
+	ForeignPath *fp = create_foreignscan_path(
+#endif
+		root,
+		joinrel,
+		NULL, // target
+		joinrel->rows, // rows
+		startup_cost, // startup_cost
+		total_cost, // total_cost
+		NIL, // pathkeys
+		NULL, // required_outer
+		NULL, // fdw_outerpath
+		NIL // fdw_private
+	);
+
+	// lists both zones in full, so never in every worker
+	fp->path.parallel_safe = false;
+
+	add_path(joinrel, (Path *) fp);
+}
+
+ForeignScan *get_foreign_join_plan(
+	PlannerInfo *root,
+	RelOptInfo *joinrel,
+	ForeignPath *best_path,
+	List *tlist,
+	Plan *outer_plan
+) {
+	elog(DEBUG1, "r53db GetForeignPlan() for join");
+
+	r53dbJoinInfo *jinfo = (r53dbJoinInfo *) joinrel->fdw_private;
+
+	List *fdw_scan_tlist = add_to_flat_tlist(NIL, joinrel->reltarget->exprs);
+	fdw_scan_tlist = add_to_flat_tlist(
+		fdw_scan_tlist,
+		pull_var_clause((Node *) jinfo->local_conds, PVC_RECURSE_PLACEHOLDERS)
+	);
+
+	List *columns = NIL;
+	ListCell *lc;
+	foreach(lc, fdw_scan_tlist) {
+		Var *var = (Var *) ((TargetEntry *) lfirst(lc))->expr;
+		enum r53dbColumn column;
+
+		if (!get_var_column(root, var, &column)) {
+			elog(ERROR, "r53db: Internal error: Unexpected column in join target list");
+			return NULL;
+		}
+
+		columns = lappend_int(columns, (var->varno == jinfo->outer_rti) ? JOIN_SIDE_OUTER : JOIN_SIDE_INNER);
+		columns = lappend_int(columns, column);
+	}
+
+	List *fdw_private = list_make4(
+		makeInteger(jinfo->jointype),
+		list_make2(makeInteger(jinfo->outer_rti), makeInteger(jinfo->inner_rti)),
+		jinfo->join_keys,
+		columns
+	);
+
+	return make_foreignscan(
+		tlist, // qptlist
+		jinfo->local_conds, // qpqual
+		0, // scanrelid
+		NIL, // fdw_exprs
+		fdw_private, // fdw_private
+		fdw_scan_tlist, // fdw_scan_tlist
+		NIL, // fdw_recheck_quals
+		outer_plan // outer_plan
+	);
+}
+
+/*----------------
+ * executor side
+ *----------------
+ */
+
+static r53dbScanState *join_scan_zone(EState *estate, Index rti, Oid user_id) {
+	r53dbScanState *scanState = (r53dbScanState *) palloc0(sizeof(r53dbScanState));
+	Oid relid = rt_fetch(rti, estate->es_range_table)->relid;
+
+	scanState->hosted_zone_id = get_relation_hosted_zone_id(relid);
+	scanState->conn = get_relation_connection_options(relid, user_id);
+
+	scan_hosted_zone(scanState, scanState->hosted_zone_id, NULL, NULL);
+	zone_stats_update(scanState->hosted_zone_id, scanState->results);
+
+	return scanState;
+}
+
+/*
+ * Build the hash key for one side of the join. Returns false if any key
+ * column is NULL, which never matches.
+ */
+static bool build_join_key(r53dbJoinScanState *js, r53dbDNSRR *rr, int side) {
+	resetStringInfo(&js->key);
+
+	for (int i = side; i < list_length(js->join_keys); i += 2) {
+		char *value = get_column_cstring(rr, (enum r53dbColumn) list_nth_int(js->join_keys, i));
+		if (value == NULL) return false;
+
+		// including the terminating NUL, as a separator
+		appendBinaryStringInfo(&js->key, value, strlen(value) + 1);
+	}
+
+	return true;
+}
+
+void begin_foreign_join_scan(ForeignScanState *node, int eflags) {
+	ForeignScan *fs = (ForeignScan *) node->ss.ps.plan;
+	r53dbJoinScanState *js = (r53dbJoinScanState *) palloc0(sizeof(r53dbJoinScanState));
+	node->fdw_state = (void *) js;
+
+	js->jointype = (JoinType) intVal(linitial(fs->fdw_private));
+	List *rtis = (List *) lsecond(fs->fdw_private);
+	js->join_keys = (List *) lthird(fs->fdw_private);
+	js->columns = (List *) lfourth(fs->fdw_private);
+
+	initStringInfo(&js->key);
+	js->probe_context = AllocSetContextCreate(CurrentMemoryContext, "r53db join probe", ALLOCSET_DEFAULT_SIZES);
+
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY) return;
+
+	// Both sides have the same user (see get_join_info()).
+	EState *estate = node->ss.ps.state;
+	Oid user_id = get_rte_user_id(estate, (Index) intVal(linitial(rtis)));
+
+	js->outer = join_scan_zone(estate, (Index) intVal(linitial(rtis)), user_id);
+	js->inner = join_scan_zone(estate, (Index) intVal(lsecond(rtis)), user_id);
+
+	js->nbuckets = 1;
+	while (js->nbuckets < list_length(js->inner->results)) {
+		js->nbuckets <<= 1;
+	}
+	js->buckets = (List **) palloc0(sizeof(List *) * js->nbuckets);
+
+	ListCell *lc;
+	foreach(lc, js->inner->results) {
+		r53dbDNSRR *rr = (r53dbDNSRR *) lfirst(lc);
+
+		if (!build_join_key(js, rr, JOIN_SIDE_INNER)) continue;
+
+		r53dbJoinEntry *entry = (r53dbJoinEntry *) palloc(sizeof(r53dbJoinEntry));
+		entry->hash = tag_hash(js->key.data, js->key.len);
+		entry->keylen = js->key.len;
+		entry->key = (char *) palloc(js->key.len);
+		memcpy(entry->key, js->key.data, js->key.len);
+		entry->rr = rr;
+
+		uint32 bucket = entry->hash & (js->nbuckets - 1);
+		js->buckets[bucket] = lappend(js->buckets[bucket], entry);
+	}
+
+	elog(
+		DEBUG1,
+		"r53db join: %d outer rows, %d inner rows in %u buckets",
+		list_length(js->outer->results),
+		list_length(js->inner->results),
+		js->nbuckets
+	);
+}
+
+static List *probe_join(r53dbJoinScanState *js, r53dbDNSRR *outer_rr) {
+	List *matches = NIL;
+
+	if (!build_join_key(js, outer_rr, JOIN_SIDE_OUTER)) return NIL;
+
+	uint32 hash = tag_hash(js->key.data, js->key.len);
+
+	ListCell *lc;
+	foreach(lc, js->buckets[hash & (js->nbuckets - 1)]) {
+		r53dbJoinEntry *entry = (r53dbJoinEntry *) lfirst(lc);
+
+		if (entry->hash == hash && entry->keylen == js->key.len && memcmp(entry->key, js->key.data, entry->keylen) == 0) {
+			matches = lappend(matches, entry->rr);
+		}
+	}
+
+	return matches;
+}
+
+static TupleTableSlot *store_join_tuple(
+	r53dbJoinScanState *js,
+	TupleTableSlot *tts,
+	r53dbDNSRR *outer_rr,
+	r53dbDNSRR *inner_rr
+) {
+	ExecClearTuple(tts);
+
+	for (int i = 0; i < tts->tts_tupleDescriptor->natts; i++) {
+		int side = list_nth_int(js->columns, 2 * i);
+		enum r53dbColumn column = (enum r53dbColumn) list_nth_int(js->columns, 2 * i + 1);
+		r53dbDNSRR *rr = (side == JOIN_SIDE_OUTER) ? outer_rr : inner_rr;
+
+		if (rr == NULL) {
+			// unmatched row of a left join
+			tts->tts_values[i] = PointerGetDatum(NULL);
+			tts->tts_isnull[i] = true;
+			continue;
+		}
+
+		get_column_value(rr, column, &tts->tts_values[i], &tts->tts_isnull[i]);
+	}
+
+	ExecStoreVirtualTuple(tts);
+
+	return tts;
+}
+
+TupleTableSlot *iterate_foreign_join_scan(ForeignScanState *node) {
+	r53dbJoinScanState *js = (r53dbJoinScanState *) node->fdw_state;
+	TupleTableSlot *tts = node->ss.ss_ScanTupleSlot;
+
+	for (;;) {
+		if (js->match_index < list_length(js->matches)) {
+			r53dbDNSRR *inner_rr = (r53dbDNSRR *) list_nth(js->matches, js->match_index);
+			js->match_index++;
+			return store_join_tuple(js, tts, js->outer_rr, inner_rr);
+		}
+
+		if (js->emit_unmatched) {
+			js->emit_unmatched = false;
+			return store_join_tuple(js, tts, js->outer_rr, NULL);
+		}
+
+		if (js->outer_index == list_length(js->outer->results)) {
+			// done
+			return NULL;
+		}
+
+		js->outer_rr = (r53dbDNSRR *) list_nth(js->outer->results, js->outer_index);
+		js->outer_index++;
+
+		// We're called in per-tuple memory, but matches are needed
+		// across calls.
+		MemoryContextReset(js->probe_context);
+		MemoryContext oldcontext = MemoryContextSwitchTo(js->probe_context);
+		js->matches = probe_join(js, js->outer_rr);
+		MemoryContextSwitchTo(oldcontext);
+
+		js->match_index = 0;
+		js->emit_unmatched = (js->matches == NIL && js->jointype == JOIN_LEFT);
+	}
+}
+
+void rescan_foreign_join_scan(ForeignScanState *node) {
+	r53dbJoinScanState *js = (r53dbJoinScanState *) node->fdw_state;
+
+	js->outer_index = 0;
+	js->outer_rr = NULL;
+	js->matches = NIL;
+	js->match_index = 0;
+	js->emit_unmatched = false;
+}
+
+static void append_join_relation(StringInfo buf, ExplainState *es, Index rti) {
+	RangeTblEntry *rte = rt_fetch(rti, es->rtable);
+	char *relname = get_rel_name(rte->relid);
+	char *refname = (char *) list_nth(es->rtable_names, rti - 1);
+
+	appendStringInfoString(buf, quote_identifier(relname));
+	if (refname != NULL && strcmp(refname, relname) != 0) {
+		appendStringInfo(buf, " %s", quote_identifier(refname));
+	}
+}
+
+void explain_foreign_join_scan(ForeignScanState *node, ExplainState *es) {
+	ForeignScan *fs = (ForeignScan *) node->ss.ps.plan;
+	JoinType jointype = (JoinType) intVal(linitial(fs->fdw_private));
+	List *rtis = (List *) lsecond(fs->fdw_private);
+	StringInfoData relations;
+
+	initStringInfo(&relations);
+	append_join_relation(&relations, es, (Index) intVal(linitial(rtis)));
+	appendStringInfoString(&relations, (jointype == JOIN_LEFT) ? " LEFT JOIN " : " INNER JOIN ");
+	append_join_relation(&relations, es, (Index) intVal(lsecond(rtis)));
+
+	ExplainPropertyText("Relations", relations.data, es);
+}
@@ -0,0 +1,31 @@
+#ifndef R53DB_JOIN_H
+#define R53DB_JOIN_H
+
+#include <postgres.h>
+#include <commands/explain.h>
+#include <foreign/fdwapi.h>
+#include <optimizer/pathnode.h>
+
+void r53dbGetForeignJoinPaths(
+	PlannerInfo *root,
+	RelOptInfo *joinrel,
+	RelOptInfo *outerrel,
+	RelOptInfo *innerrel,
+	JoinType jointype,
+	JoinPathExtraData *extra
+);
+
+ForeignScan *get_foreign_join_plan(
+	PlannerInfo *root,
+	RelOptInfo *joinrel,
+	ForeignPath *best_path,
+	List *tlist,
+	Plan *outer_plan
+);
+
+void begin_foreign_join_scan(ForeignScanState *node, int eflags);
+TupleTableSlot *iterate_foreign_join_scan(ForeignScanState *node);
+void rescan_foreign_join_scan(ForeignScanState *node);
+void explain_foreign_join_scan(ForeignScanState *node, ExplainState *es);
+
+#endif // R53DB_JOIN_H
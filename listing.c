@@ -0,0 +1,190 @@
+#include <stdio.h>
+
+#include <postgres.h>
+#include <miscadmin.h>
+#include <pgstat.h>
+#include <storage/ipc.h>
+#include <storage/latch.h>
+#include <utils/memutils.h>
+
+#include "compat.h"
+#include "dns.h"
+#include "go_functions.h"
+#include "listing.h"
+#include "ratelimit.h"
+#include "snapshot.h"
+
+r53dbListing *listing_begin(r53dbConnOptions *conn, char *hosted_zone_id, char *start, char *stop) {
+	r53dbListing *listing = (r53dbListing *) palloc0(sizeof(r53dbListing));
+
+	listing->conn = conn;
+	listing->hosted_zone_id = hosted_zone_id;
+	listing->start = start;
+	listing->stop = stop;
+	listing->context = CurrentMemoryContext;
+	listing->job = InvalidGoJob;
+	listing->next_name = start;
+	listing->state = LISTING_PAGES;
+
+	// Snapshots only cover full listings
+	if (r53db_snapshot_max_age != 0 && start == NULL && stop == NULL) {
+		listing->use_snapshot = true;
+		listing->generation = snapshot_generation(hosted_zone_id);
+
+		if (snapshot_exists(hosted_zone_id)) {
+			listing->state = LISTING_COUNT;
+		}
+	}
+
+	return listing;
+}
+
+/*
+ * Returns false if the next request has to wait for its slot (until
+ * listing->not_before).
+ */
+static bool listing_may_send(r53dbListing *listing) {
+	if (listing->rate_limit == NULL) return true;
+
+	if (listing->not_before == 0) {
+		listing->not_before = rate_limit_reserve(listing->rate_limit);
+	}
+
+	if (rate_limit_delay(listing->not_before) > 0) return false;
+
+	listing->not_before = 0;
+	return true;
+}
+
+static void listing_send(r53dbListing *listing) {
+	switch (listing->state) {
+	case LISTING_COUNT:
+	case LISTING_RECOUNT:
+		listing->job = go_get_rrset_count(listing->conn, listing->hosted_zone_id);
+		return;
+
+	case LISTING_PAGES:
+		listing->job = go_list_rrsets(
+			listing->conn,
+			listing->hosted_zone_id,
+			listing->next_name,
+			listing->next_type,
+			listing->next_identifier,
+			listing->stop
+		);
+		return;
+
+	default:
+		elog(ERROR, "r53db: unexpected request in listing state %d", listing->state);
+	}
+}
+
+static void listing_handle_result(r53dbListing *listing, r53dbAWSResult *result) {
+	switch (listing->state) {
+	case LISTING_COUNT:
+		// Route53 has no change serial for zones; the RRSet count is the
+		// cheapest thing we can check a snapshot against.
+		if (result->count >= 0 && snapshot_load(listing->hosted_zone_id, result->count, &listing->results)) {
+			listing->state = LISTING_DONE;
+			return;
+		}
+
+		listing->state = LISTING_PAGES;
+		return;
+
+	case LISTING_PAGES:
+		for (int i = 0; i < result->nrows; i++) {
+			listing->results = lappend(listing->results, &result->rows[i]);
+		}
+
+		listing->npages++;
+		listing->rrsets_listed += result->count;
+
+		if (result->next_name != NULL) {
+			listing->next_name = result->next_name;
+			listing->next_type = result->next_type;
+			listing->next_identifier = result->next_identifier;
+			return;
+		}
+
+		// a single page is as quick to list as to check a snapshot
+		listing->state = (listing->use_snapshot && listing->npages > 1) ? LISTING_RECOUNT : LISTING_DONE;
+		return;
+
+	case LISTING_RECOUNT:
+		// Changes made elsewhere while we were listing mostly show up here.
+		if (result->count == listing->rrsets_listed) {
+			snapshot_write(listing->hosted_zone_id, result->count, listing->generation, listing->results);
+		} else {
+			elog(DEBUG1, "r53db: zone %s has " INT64_FORMAT " RRSets after listing " INT64_FORMAT ", not writing a snapshot",
+				listing->hosted_zone_id, result->count, listing->rrsets_listed);
+		}
+
+		listing->state = LISTING_DONE;
+		return;
+
+	default:
+		elog(ERROR, "r53db: unexpected result in listing state %d", listing->state);
+	}
+}
+
+/*
+ * Advance the listing as far as possible without waiting. Returns true
+ * once it's done; the rows are in listing->results then.
+ */
+bool listing_step(r53dbListing *listing) {
+	MemoryContext oldcontext = MemoryContextSwitchTo(listing->context);
+
+	while (listing->state != LISTING_DONE) {
+		if (listing->job == InvalidGoJob) {
+			if (!listing_may_send(listing)) break;
+			listing_send(listing);
+		}
+
+		if (!go_job_done(listing->job)) break;
+
+		r53dbGoJob job = listing->job;
+		listing->job = InvalidGoJob;
+		listing_handle_result(listing, go_job_result(job));
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	return (listing->state == LISTING_DONE);
+}
+
+/*
+ * After listing_step() returned false: milliseconds until the listing can
+ * send its next request, or -1 if it's waiting for a job.
+ */
+long listing_delay(r53dbListing *listing) {
+	if (listing->job != InvalidGoJob) return -1;
+
+	return rate_limit_delay(listing->not_before);
+}
+
+List *listing_run(r53dbListing *listing) {
+	while (!listing_step(listing)) {
+		long delay = listing_delay(listing);
+
+		if (delay < 0) {
+			go_wait(listing->job);
+			continue;
+		}
+
+		int rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, delay, PG_WAIT_EXTENSION);
+		if (rc & WL_POSTMASTER_DEATH) {
+			proc_exit(1);
+		}
+
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	return listing->results;
+}
+
+void listing_cancel(r53dbListing *listing) {
+	go_job_forget(listing->job);
+	listing->job = InvalidGoJob;
+}
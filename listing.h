@@ -0,0 +1,62 @@
+#ifndef R53DB_LISTING_H
+#define R53DB_LISTING_H
+
+#include <postgres.h>
+#include <datatype/timestamp.h>
+#include <nodes/pg_list.h>
+#include <port/atomics.h>
+
+#include "dns.h"
+#include "go_functions.h"
+
+typedef enum r53dbListingState {
+	LISTING_COUNT, // getting the RRSet count, to check the snapshot
+	LISTING_PAGES, // getting the next page
+	LISTING_RECOUNT, // getting the RRSet count, to write a snapshot
+	LISTING_DONE
+} r53dbListingState;
+
+/*
+ * A zone listing, one API request at a time. Backends run it to completion
+ * with listing_run(); the broker runs many of them side by side, calling
+ * listing_step() whenever one of its jobs might be done.
+ *
+ * 'start' and 'stop' limit the listing to a name range (NULL for a full
+ * listing). Rows are collected in the memory context that was current in
+ * listing_begin(). If 'rate_limit' is set, every request waits for its
+ * slot (see ratelimit.h).
+ *
+ * Full listings use zone snapshots if enabled: An existing snapshot costs
+ * one GetHostedZone call to check, and zones that take more than one page
+ * to list cost one more to write a snapshot (only if the RRSet count after
+ * listing matches what we listed).
+ */
+typedef struct r53dbListing {
+	r53dbConnOptions *conn;
+	char *hosted_zone_id;
+	char *start;
+	char *stop;
+	MemoryContext context;
+	pg_atomic_uint64 *rate_limit;
+
+	r53dbListingState state;
+	r53dbGoJob job; // InvalidGoJob: next request not sent yet
+	TimestampTz not_before; // reserved slot for the next request
+	bool use_snapshot;
+	uint64 generation; // see snapshot.h
+	int npages;
+	int64 rrsets_listed;
+	char *next_name;
+	char *next_type;
+	char *next_identifier;
+
+	List *results;
+} r53dbListing;
+
+r53dbListing *listing_begin(r53dbConnOptions *conn, char *hosted_zone_id, char *start, char *stop);
+bool listing_step(r53dbListing *listing);
+long listing_delay(r53dbListing *listing);
+List *listing_run(r53dbListing *listing);
+void listing_cancel(r53dbListing *listing);
+
+#endif // R53DB_LISTING_H
@@ -3,9 +3,17 @@
 #include <postgres.h>
 #include <fmgr.h>
 
+#include <access/reloptions.h>
 #include <foreign/foreign.h>
+#include <catalog/pg_foreign_server.h>
+#include <catalog/pg_foreign_table.h>
 #include <catalog/pg_type.h>
+#include <catalog/pg_user_mapping.h>
+#include <lib/stringinfo.h>
+#include <miscadmin.h>
+#include <parser/parsetree.h>
 #include <utils/builtins.h>
+#include <utils/syscache.h>
 
 #include "dns.h"
 #include "misc.h"
@@ -27,51 +35,223 @@ char *get_relation_hosted_zone_id(Oid relation_id) {
 	elog(ERROR, "Missing hosted_zone_id option in foreign table defintion");
 }
 
+/*
+ * GetUserMapping() errors out if there is no user mapping at all, but
+ * we want to keep working without one (using the default credential chain).
+ */
+static bool user_mapping_exists(Oid user_id, Oid server_id) {
+	HeapTuple tp = SearchSysCache2(
+		USERMAPPINGUSERSERVER,
+		ObjectIdGetDatum(user_id),
+		ObjectIdGetDatum(server_id)
+	);
+
+	if (!HeapTupleIsValid(tp)) {
+		// try PUBLIC
+		tp = SearchSysCache2(
+			USERMAPPINGUSERSERVER,
+			ObjectIdGetDatum(InvalidOid),
+			ObjectIdGetDatum(server_id)
+		);
+	}
+
+	if (!HeapTupleIsValid(tp)) {
+		return false;
+	}
+
+	ReleaseSysCache(tp);
+	return true;
+}
+
+typedef struct r53dbOption {
+	const char *name;
+	Oid catalog;
+} r53dbOption;
+
+/*
+ * Credentials are only accepted in user mappings (like passwords in
+ * postgres_fdw), so they're not visible to everybody who can use the
+ * foreign server.
+ *
+ * Options that make use of the server's own credentials (its AWS profiles,
+ * the roles they may assume, and where requests signed with them go) are
+ * only accepted on the foreign server: Anybody with USAGE on it can create
+ * a user mapping.
+ */
+static const r53dbOption valid_options[] = {
+	{"region", ForeignServerRelationId},
+	{"endpoint", ForeignServerRelationId},
+	{"profile", ForeignServerRelationId},
+	{"role_arn", ForeignServerRelationId},
+	{"region", UserMappingRelationId},
+	{"access_key_id", UserMappingRelationId},
+	{"secret_access_key", UserMappingRelationId},
+	{"session_token", UserMappingRelationId},
+	{"dns_name", ForeignTableRelationId},
+	{"hosted_zone_id", ForeignTableRelationId},
+	{NULL, InvalidOid}
+};
+
+static bool is_valid_option(const char *name, Oid catalog) {
+	for (const r53dbOption *opt = valid_options; opt->name != NULL; opt++) {
+		if (opt->catalog == catalog && strcmp(opt->name, name) == 0) return true;
+	}
+
+	return false;
+}
+
+/*
+ * Reject unknown options: A misspelled credential option would otherwise
+ * silently fall back to the server's default credentials.
+ */
+PG_FUNCTION_INFO_V1(r53db_fdw_validator);
+Datum r53db_fdw_validator(PG_FUNCTION_ARGS) {
+	List *options = untransformRelOptions(PG_GETARG_DATUM(0));
+	Oid catalog = PG_GETARG_OID(1);
+
+	ListCell *lc;
+	foreach(lc, options) {
+		DefElem *opt = (DefElem *) lfirst(lc);
+
+		if (is_valid_option(opt->defname, catalog)) continue;
+
+		StringInfoData valid;
+		initStringInfo(&valid);
+		for (const r53dbOption *vopt = valid_options; vopt->name != NULL; vopt++) {
+			if (vopt->catalog != catalog) continue;
+			appendStringInfo(&valid, "%s%s", (valid.len > 0) ? ", " : "", vopt->name);
+		}
+
+		ereport(ERROR, (
+			errcode(ERRCODE_FDW_INVALID_OPTION_NAME),
+			errmsg("r53db: invalid option \"%s\"", opt->defname),
+			(valid.len > 0)
+				? errhint("Valid options in this context are: %s", valid.data)
+				: errhint("There are no valid options in this context.")
+		));
+	}
+
+	PG_RETURN_VOID();
+}
+
+static void set_connection_option(r53dbConnOptions *conn, DefElem *opt) {
+	char *value = ((Value *) opt->arg)->val.str;
+
+	if (strcmp(opt->defname, "region") == 0) {
+		conn->region = value;
+	} else if (strcmp(opt->defname, "endpoint") == 0) {
+		conn->endpoint = value;
+	} else if (strcmp(opt->defname, "profile") == 0) {
+		conn->profile = value;
+	} else if (strcmp(opt->defname, "access_key_id") == 0) {
+		conn->access_key_id = value;
+	} else if (strcmp(opt->defname, "secret_access_key") == 0) {
+		conn->secret_access_key = value;
+	} else if (strcmp(opt->defname, "session_token") == 0) {
+		conn->session_token = value;
+	} else if (strcmp(opt->defname, "role_arn") == 0) {
+		conn->role_arn = value;
+	}
+}
+
+/*
+ * Collect the AWS connection settings for the given server and user.
+ * Options in the user mapping override those of the foreign server.
+ */
+r53dbConnOptions *get_connection_options(Oid server_id, Oid user_id) {
+	r53dbConnOptions *conn = (r53dbConnOptions *) palloc0(sizeof(r53dbConnOptions));
+	ForeignServer *fs = GetForeignServer(server_id);
+
+	ListCell *lcopt;
+	foreach(lcopt, fs->options) {
+		set_connection_option(conn, (DefElem *) lfirst(lcopt));
+	}
+
+	if (user_mapping_exists(user_id, server_id)) {
+		UserMapping *um = GetUserMapping(user_id, server_id);
+
+		foreach(lcopt, um->options) {
+			DefElem *opt = (DefElem *) lfirst(lcopt);
+
+			// set before the validator existed (see r53db--0.1--0.2.sql)
+			if (!is_valid_option(opt->defname, UserMappingRelationId)) {
+				elog(ERROR, "r53db: option \"%s\" is not allowed in user mappings", opt->defname);
+			}
+
+			set_connection_option(conn, opt);
+		}
+	}
+
+	if ((conn->access_key_id == NULL) != (conn->secret_access_key == NULL)) {
+		elog(ERROR, "r53db: access_key_id and secret_access_key must be used together");
+	}
+
+	return conn;
+}
+
+r53dbConnOptions *get_relation_connection_options(Oid relation_id, Oid user_id) {
+	ForeignTable *ft = GetForeignTable(relation_id);
+	return get_connection_options(ft->serverid, user_id);
+}
+
+/*
+ * The user whose user mapping applies to a range table entry: For tables
+ * accessed through a view, that's the view owner.
+ */
+Oid get_rte_user_id(EState *estate, Index rti) {
+	RangeTblEntry *rte = rt_fetch(rti, estate->es_range_table);
+
+	return OidIsValid(rte->checkAsUser) ? rte->checkAsUser : GetUserId();
+}
+
+bool get_column_by_name(const char *attname, enum r53dbColumn *column, Oid *atttypid) {
+	if (strcmp(attname, "name") == 0) {
+		*column = name;
+		*atttypid = TEXTOID;
+	} else if (strcmp(attname, "type") == 0) {
+		*column = type;
+		*atttypid = TEXTOID;
+	} else if (strcmp(attname, "ttl") == 0) {
+		*column = ttl;
+		*atttypid = INT4OID;
+	} else if (strcmp(attname, "data") == 0) {
+		*column = data;
+		*atttypid = TEXTOID;
+	} else if (strcmp(attname, "at_dns_name") == 0) {
+		*column = at_dns_name;
+		*atttypid = TEXTOID;
+	} else if (strcmp(attname, "at_hosted_zone_id") == 0) {
+		*column = at_hosted_zone_id;
+		*atttypid = TEXTOID;
+	} else if (strcmp(attname, "at_evaluate_target_health") == 0) {
+		*column = at_evaluate_target_health;
+		*atttypid = BOOLOID;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
 List *get_column_positions(TupleDesc td) {
 	List *res = NIL;
 
 	for (int attnum = 0; attnum < td->natts; attnum++) {
 		r53dbColumnPosition *cpos = (r53dbColumnPosition *) palloc0(sizeof(r53dbColumnPosition));
-		int expected_atttypid = -1;
+		Oid expected_atttypid;
 
 		Form_pg_attribute attr = TupleDescAttr(td, attnum);
 		if (attr->attisdropped) continue;
 
 		char *attname = NameStr(attr->attname);
 
-		if (strcmp(attname, "name") == 0) {
-			cpos->column = name;
-			cpos->position = attnum;
-			expected_atttypid = TEXTOID;
-		} else if (strcmp(attname, "type") == 0) {
-			cpos->column = type;
-			cpos->position = attnum;
-			expected_atttypid = TEXTOID;
-		} else if (strcmp(attname, "ttl") == 0) {
-			cpos->column = ttl;
-			cpos->position = attnum;
-			expected_atttypid = INT4OID;
-		} else if (strcmp(attname, "data") == 0) {
-			cpos->column = data;
-			cpos->position = attnum;
-			expected_atttypid = TEXTOID;
-		} else if (strcmp(attname, "at_dns_name") == 0) {
-			cpos->column = at_dns_name;
-			cpos->position = attnum;
-			expected_atttypid = TEXTOID;
-		} else if (strcmp(attname, "at_hosted_zone_id") == 0) {
-			cpos->column = at_hosted_zone_id;
-			cpos->position = attnum;
-			expected_atttypid = TEXTOID;
-		} else if (strcmp(attname, "at_evaluate_target_health") == 0) {
-			cpos->column = at_evaluate_target_health;
-			cpos->position = attnum;
-			expected_atttypid = BOOLOID;
-		} else {
+		if (!get_column_by_name(attname, &cpos->column, &expected_atttypid)) {
 			elog(ERROR, "invalid column name %s in table definition", attname);
 			return NIL;
 		}
 
+		cpos->position = attnum;
+
 		if (attr->atttypid != expected_atttypid) {
 			elog(FATAL, "invalid data type for column %s", attname);
 			return NIL;
@@ -83,6 +263,62 @@ List *get_column_positions(TupleDesc td) {
 	return res;
 }
 
+/*
+ * The value of an RR's column, as seen in SQL: TTL and data are NULL for
+ * ALIAS targets, and the at_* columns are NULL for everything else.
+ */
+void get_column_value(r53dbDNSRR *rr, enum r53dbColumn column, Datum *value, bool *isnull) {
+	switch (column) {
+	case name:
+		*value = CStringGetTextDatum(rr->name);
+		*isnull = false;
+		break;
+	case type:
+		*value = CStringGetTextDatum(rr->type);
+		*isnull = false;
+		break;
+	case ttl:
+		*value = Int32GetDatum(rr->ttl);
+		*isnull = (rr->at_dns_name != NULL);
+		break;
+	case data:
+		*value = CStringGetTextDatumOrNULL(rr->data);
+		*isnull = (rr->at_dns_name != NULL);
+		break;
+	case at_dns_name:
+		*value = CStringGetTextDatumOrNULL(rr->at_dns_name);
+		*isnull = (rr->at_dns_name == NULL);
+		break;
+	case at_hosted_zone_id:
+		*value = CStringGetTextDatumOrNULL(rr->at_hosted_zone_id);
+		*isnull = (rr->at_dns_name == NULL);
+		break;
+	case at_evaluate_target_health:
+		*value = BoolGetDatum(rr->at_evaluate_target_health);
+		*isnull = (rr->at_dns_name == NULL);
+		break;
+	default:
+		elog(ERROR, "Internal error: Invalid column %d in column list", column);
+	}
+}
+
+/*
+ * Same as get_column_value(), without the detour through a Datum --
+ * for text columns only. Returns NULL for SQL NULL.
+ */
+char *get_column_cstring(r53dbDNSRR *rr, enum r53dbColumn column) {
+	switch (column) {
+	case name: return rr->name;
+	case type: return rr->type;
+	case data: return (rr->at_dns_name == NULL) ? rr->data : NULL;
+	case at_dns_name: return rr->at_dns_name;
+	case at_hosted_zone_id: return (rr->at_dns_name != NULL) ? rr->at_hosted_zone_id : NULL;
+	default:
+		elog(ERROR, "Internal error: Column %d is not a text column", column);
+		return NULL;
+	}
+}
+
 r53dbDNSRR *get_rr_from_values(Datum *values, bool *isnulls, List *column_positions) {
 	r53dbDNSRR *rr = palloc0(sizeof(r53dbDNSRR));
 
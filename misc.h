@@ -3,9 +3,18 @@
 
 #include <postgres.h>
 #include <access/tupdesc.h>
+#include <nodes/execnodes.h>
+
+#include "fdw.h"
 
 char *get_relation_hosted_zone_id(Oid relation_id);
+r53dbConnOptions *get_connection_options(Oid server_id, Oid user_id);
+r53dbConnOptions *get_relation_connection_options(Oid relation_id, Oid user_id);
+Oid get_rte_user_id(EState *estate, Index rti);
+bool get_column_by_name(const char *attname, enum r53dbColumn *column, Oid *atttypid);
 List *get_column_positions(TupleDesc td);
+void get_column_value(r53dbDNSRR *rr, enum r53dbColumn column, Datum *value, bool *isnull);
+char *get_column_cstring(r53dbDNSRR *rr, enum r53dbColumn column);
 r53dbDNSRR *get_rr_from_values(Datum *values, bool *isnulls, List *column_positions);
 
 void palloc_string(char **s);
@@ -0,0 +1,7 @@
+CREATE FUNCTION r53db_fdw_validator(text[], oid)
+RETURNS void
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', 'r53db_fdw_validator';
+
+ALTER FOREIGN DATA WRAPPER r53db
+VALIDATOR r53db_fdw_validator;
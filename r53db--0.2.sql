@@ -0,0 +1,13 @@
+CREATE FUNCTION r53db_fdw_handler()
+RETURNS fdw_handler
+LANGUAGE C
+AS 'MODULE_PATHNAME', 'r53db_fdw_handler';
+
+CREATE FUNCTION r53db_fdw_validator(text[], oid)
+RETURNS void
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', 'r53db_fdw_validator';
+
+CREATE FOREIGN DATA WRAPPER r53db
+HANDLER r53db_fdw_handler
+VALIDATOR r53db_fdw_validator;
@@ -0,0 +1,31 @@
+#include <postgres.h>
+#include <port/atomics.h>
+#include <utils/timestamp.h>
+
+#include "ratelimit.h"
+
+void rate_limit_init(pg_atomic_uint64 *next_request_at) {
+	pg_atomic_init_u64(next_request_at, 0);
+}
+
+TimestampTz rate_limit_reserve(pg_atomic_uint64 *next_request_at) {
+	TimestampTz now = GetCurrentTimestamp();
+	uint64 next = pg_atomic_read_u64(next_request_at);
+	TimestampTz slot;
+
+	// on failure, 'next' is updated to the current value
+	do {
+		slot = Max(now, (TimestampTz) next);
+	} while (!pg_atomic_compare_exchange_u64(next_request_at, &next, (uint64) (slot + R53DB_REQUEST_INTERVAL)));
+
+	return slot;
+}
+
+// milliseconds until 'slot', rounded up
+long rate_limit_delay(TimestampTz slot) {
+	TimestampTz now = GetCurrentTimestamp();
+
+	if (slot <= now) return 0;
+
+	return (long) ((slot - now + 999) / 1000);
+}
@@ -0,0 +1,24 @@
+#ifndef R53DB_RATELIMIT_H
+#define R53DB_RATELIMIT_H
+
+#include <postgres.h>
+#include <datatype/timestamp.h>
+#include <port/atomics.h>
+
+/*
+ * Route53 allows five API requests per second per AWS account. Requests
+ * that share a rate limit -- the participants of a parallel scan, or all
+ * listings in the broker -- take turns in slots this far apart.
+ */
+#define R53DB_REQUEST_INTERVAL (200 * 1000L) // microseconds
+
+/*
+ * The rate limit itself is just the time of the next free slot, so it can
+ * live in DSM. rate_limit_reserve() claims a slot and returns its time;
+ * the request must not be sent before then.
+ */
+void rate_limit_init(pg_atomic_uint64 *next_request_at);
+TimestampTz rate_limit_reserve(pg_atomic_uint64 *next_request_at);
+long rate_limit_delay(TimestampTz slot);
+
+#endif // R53DB_RATELIMIT_H
@@ -0,0 +1,414 @@
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <postgres.h>
+#include <miscadmin.h>
+
+#include <lib/stringinfo.h>
+#include <storage/fd.h>
+#include <utils/memutils.h>
+
+#include "compat.h"
+#include "dns.h"
+#include "fdw.h"
+#include "snapshot.h"
+#include "zonestats.h"
+
+/*
+ * Every zone has a generation counter in pg_r53db/<id>.gen, which is bumped
+ * around each change made through r53db. A snapshot is only valid for the
+ * generation its listing started in, so a listing that overlapped a change
+ * is never used (nor written, if we notice in time).
+ *
+ * A snapshot file is a header, followed by 'nrows' rows. Each row is a
+ * uint32 TTL, a flags byte and then those of the row's strings that are
+ * set (NUL-terminated, in snapshot_strings order). Nothing is aligned, so
+ * the strings can be used right where they are in the mapping.
+ */
+#define SNAPSHOT_DIR "pg_r53db"
+#define SNAPSHOT_MAGIC "R53DBSN2"
+
+#define SNAPSHOT_EVALUATE_TARGET_HEALTH 0x80
+
+typedef struct {
+	char magic[8];
+	int64 rrset_count;
+	uint64 generation;
+	int64 written_at;
+	uint32 nrows;
+	uint32 size;
+} r53dbSnapshotHeader;
+
+typedef struct {
+	char *addr;
+	size_t size;
+} r53dbSnapshotMapping;
+
+// flag bit i says that snapshot_strings[i] follows
+static const size_t snapshot_strings[] = {
+	offsetof(r53dbDNSRR, name),
+	offsetof(r53dbDNSRR, type),
+	offsetof(r53dbDNSRR, data),
+	offsetof(r53dbDNSRR, at_dns_name),
+	offsetof(r53dbDNSRR, at_hosted_zone_id),
+};
+
+#define SNAPSHOT_NSTRINGS lengthof(snapshot_strings)
+
+// 0 disables snapshots, -1 only checks the RRSet count
+int r53db_snapshot_max_age = 0;
+
+static char **snapshot_rr_string(r53dbDNSRR *rr, int i) {
+	return (char **) ((char *) rr + snapshot_strings[i]);
+}
+
+static bool snapshot_path(char *hosted_zone_id, const char *suffix, char *path) {
+	// "/hostedzone/Z0123456789" -> "pg_r53db/Z0123456789.snap"
+	char *id = strrchr(hosted_zone_id, '/');
+	id = (id != NULL) ? id + 1 : hosted_zone_id;
+
+	if (*id == '\0' || strlen(id) >= R53DB_ZONE_ID_LEN) return false;
+
+	for (char *c = id; *c != '\0'; c++) {
+		if (!isalnum((unsigned char) *c)) return false;
+	}
+
+	snprintf(path, MAXPGPATH, "%s/%s.%s", SNAPSHOT_DIR, id, suffix);
+	return true;
+}
+
+uint64 snapshot_generation(char *hosted_zone_id) {
+	char path[MAXPGPATH];
+	uint64 generation = 0;
+
+	if (!snapshot_path(hosted_zone_id, "gen", path)) return 0;
+
+	int fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+	if (fd < 0) return 0;
+
+	if (flock(fd, LOCK_SH) < 0 || pread(fd, &generation, sizeof(generation), 0) != sizeof(generation)) {
+		generation = 0;
+	}
+
+	CloseTransientFile(fd);
+	return generation;
+}
+
+static void snapshot_unmap(void *arg) {
+	r53dbSnapshotMapping *mapping = (r53dbSnapshotMapping *) arg;
+
+	munmap(mapping->addr, mapping->size);
+}
+
+static bool snapshot_parse_rows(char *p, char *end, uint32 nrows, List **results) {
+	for (uint32 i = 0; i < nrows; i++) {
+		if (end - p < sizeof(uint32) + 1) return false;
+
+		r53dbDNSRR *rr = palloc0(sizeof(r53dbDNSRR));
+		memcpy(&rr->ttl, p, sizeof(uint32));
+		p += sizeof(uint32);
+
+		uint8 flags = (uint8) *p++;
+		rr->at_evaluate_target_health = (flags & SNAPSHOT_EVALUATE_TARGET_HEALTH) != 0;
+
+		for (int f = 0; f < SNAPSHOT_NSTRINGS; f++) {
+			if ((flags & (1 << f)) == 0) continue;
+
+			char *nul = memchr(p, '\0', end - p);
+			if (nul == NULL) return false;
+
+			*snapshot_rr_string(rr, f) = p;
+			p = nul + 1;
+		}
+
+		if (rr->name == NULL || rr->type == NULL) return false;
+
+		*results = lappend(*results, rr);
+	}
+
+	return (p == end);
+}
+
+/*
+ * Is a snapshot with this header still valid for the zone? A negative
+ * rrset_count skips the RRSet count check.
+ */
+static bool snapshot_header_valid(char *hosted_zone_id, r53dbSnapshotHeader *header, int64 rrset_count) {
+	int64 age = (int64) time(NULL) - header->written_at;
+	uint64 generation = snapshot_generation(hosted_zone_id);
+
+	if ((rrset_count >= 0 && header->rrset_count != rrset_count) ||
+		header->generation != generation ||
+		(r53db_snapshot_max_age > 0 && age > r53db_snapshot_max_age)) {
+		elog(DEBUG1, "r53db: snapshot for zone %s is stale (" INT64_FORMAT " RRSets, generation " UINT64_FORMAT ", " INT64_FORMAT " seconds old)",
+			hosted_zone_id, header->rrset_count, header->generation, age);
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * Map a zone's snapshot and append its rows to *rows. Returns false (and
+ * leaves *rows alone) if there's no usable snapshot. A negative
+ * rrset_count skips the RRSet count check.
+ */
+static bool snapshot_read(char *hosted_zone_id, int64 rrset_count, List **rows) {
+	char path[MAXPGPATH];
+	struct stat st;
+	r53dbSnapshotHeader header;
+
+	if (!snapshot_path(hosted_zone_id, "snap", path)) return false;
+
+	int fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+	if (fd < 0) return false;
+
+	if (fstat(fd, &st) < 0 || st.st_size < sizeof(header)) {
+		CloseTransientFile(fd);
+		return false;
+	}
+
+	char *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	CloseTransientFile(fd);
+
+	if (addr == MAP_FAILED) {
+		elog(LOG, "r53db: could not map snapshot \"%s\": %m", path);
+		return false;
+	}
+
+	memcpy(&header, addr, sizeof(header));
+
+	if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.size != st.st_size) {
+		elog(LOG, "r53db: ignoring invalid snapshot \"%s\"", path);
+		munmap(addr, st.st_size);
+		return false;
+	}
+
+	if (!snapshot_header_valid(hosted_zone_id, &header, rrset_count)) {
+		munmap(addr, st.st_size);
+		return false;
+	}
+
+	// From here on, the mapping goes away with the current memory context
+	r53dbSnapshotMapping *mapping = palloc(sizeof(r53dbSnapshotMapping));
+	mapping->addr = addr;
+	mapping->size = st.st_size;
+
+	MemoryContextCallback *callback = palloc(sizeof(MemoryContextCallback));
+	callback->func = snapshot_unmap;
+	callback->arg = mapping;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, callback);
+
+	List *results = NIL;
+	if (!snapshot_parse_rows(addr + sizeof(header), addr + st.st_size, header.nrows, &results)) {
+		elog(LOG, "r53db: ignoring corrupt snapshot \"%s\"", path);
+		list_free_deep(results);
+		return false;
+	}
+
+	*rows = list_concat(*rows, results);
+	return true;
+}
+
+/*
+ * Is there a snapshot of the zone that's valid as far as we can tell
+ * without asking Route53 (i.e. apart from the RRSet count)?
+ */
+static bool snapshot_read_header(char *hosted_zone_id, r53dbSnapshotHeader *header) {
+	char path[MAXPGPATH];
+
+	if (r53db_snapshot_max_age == 0) return false;
+	if (!snapshot_path(hosted_zone_id, "snap", path)) return false;
+
+	int fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+	if (fd < 0) return false;
+
+	bool is_valid = (
+		read(fd, header, sizeof(*header)) == sizeof(*header) &&
+		memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+		snapshot_header_valid(hosted_zone_id, header, -1)
+	);
+
+	CloseTransientFile(fd);
+	return is_valid;
+}
+
+bool snapshot_exists(char *hosted_zone_id) {
+	r53dbSnapshotHeader header;
+
+	return snapshot_read_header(hosted_zone_id, &header);
+}
+
+bool snapshot_load(char *hosted_zone_id, int64 rrset_count, List **rows) {
+	int nrows = list_length(*rows);
+
+	if (!snapshot_read(hosted_zone_id, rrset_count, rows)) return false;
+
+	elog(DEBUG1, "r53db: listing of zone %s served from snapshot (%d rows)", hosted_zone_id, list_length(*rows) - nrows);
+	return true;
+}
+
+/*
+ * Write a full listing of a zone, which started in the given generation.
+ * Failing to do so isn't worth failing the query for; we'll just list the
+ * zone again next time.
+ */
+void snapshot_write(char *hosted_zone_id, int64 rrset_count, uint64 generation, List *results) {
+	char path[MAXPGPATH];
+	char tmppath[MAXPGPATH];
+	StringInfoData buf;
+	r53dbSnapshotHeader header;
+	ListCell *lc;
+
+	if (!snapshot_path(hosted_zone_id, "snap", path)) return;
+
+	if (snapshot_generation(hosted_zone_id) != generation) {
+		elog(DEBUG1, "r53db: zone %s was changed while listing it, not writing a snapshot", hosted_zone_id);
+		return;
+	}
+
+	snprintf(tmppath, MAXPGPATH, "%s.%d.tmp", path, MyProcPid);
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.rrset_count = rrset_count;
+	header.generation = generation;
+	header.written_at = (int64) time(NULL);
+	header.nrows = list_length(results);
+
+	initStringInfo(&buf);
+	appendBinaryStringInfo(&buf, (char *) &header, sizeof(header));
+
+	foreach(lc, results) {
+		r53dbDNSRR *rr = (r53dbDNSRR *) lfirst(lc);
+		uint8 flags = rr->at_evaluate_target_health ? SNAPSHOT_EVALUATE_TARGET_HEALTH : 0;
+
+		for (int f = 0; f < SNAPSHOT_NSTRINGS; f++) {
+			if (*snapshot_rr_string(rr, f) != NULL) flags |= (1 << f);
+		}
+
+		appendBinaryStringInfo(&buf, (char *) &rr->ttl, sizeof(uint32));
+		appendStringInfoChar(&buf, (char) flags);
+
+		for (int f = 0; f < SNAPSHOT_NSTRINGS; f++) {
+			char *s = *snapshot_rr_string(rr, f);
+			if (s != NULL) appendBinaryStringInfo(&buf, s, strlen(s) + 1);
+		}
+	}
+
+	((r53dbSnapshotHeader *) buf.data)->size = buf.len;
+
+	if (MakePGDirectory(SNAPSHOT_DIR) < 0 && errno != EEXIST) {
+		elog(LOG, "r53db: could not create directory \"%s\": %m", SNAPSHOT_DIR);
+		pfree(buf.data);
+		return;
+	}
+
+	int fd = OpenTransientFile(tmppath, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY);
+	if (fd < 0) {
+		elog(LOG, "r53db: could not create snapshot \"%s\": %m", tmppath);
+		pfree(buf.data);
+		return;
+	}
+
+	errno = 0;
+	if (write(fd, buf.data, buf.len) != buf.len) {
+		if (errno == 0) errno = ENOSPC;
+		elog(LOG, "r53db: could not write snapshot \"%s\": %m", tmppath);
+		CloseTransientFile(fd);
+		unlink(tmppath);
+		pfree(buf.data);
+		return;
+	}
+
+	CloseTransientFile(fd);
+	pfree(buf.data);
+
+	// Readers see either the old or the new snapshot, never a partial one,
+	// and after a crash, the one that matches the generation file.
+	if (durable_rename(tmppath, path, LOG) != 0) {
+		unlink(tmppath);
+		return;
+	}
+
+	elog(DEBUG1, "r53db: wrote %d rows for zone %s to snapshot", header.nrows, hosted_zone_id);
+}
+
+static void snapshot_remove(char *hosted_zone_id) {
+	char path[MAXPGPATH];
+
+	if (!snapshot_path(hosted_zone_id, "snap", path)) return;
+
+	if (unlink(path) < 0 && errno != ENOENT) {
+		elog(LOG, "r53db: could not remove snapshot \"%s\": %m", path);
+	}
+}
+
+/*
+ * Bump the zone's generation. This happens whether or not snapshots are
+ * enabled in this session, as other sessions might be listing the zone.
+ * If we can't, remove the snapshot instead (which a concurrent listing
+ * might write again, but that's the best we can do).
+ */
+void snapshot_invalidate(char *hosted_zone_id) {
+	char path[MAXPGPATH];
+	uint64 generation = 0;
+
+	if (!snapshot_path(hosted_zone_id, "gen", path)) return;
+
+	if (MakePGDirectory(SNAPSHOT_DIR) < 0 && errno != EEXIST) {
+		elog(LOG, "r53db: could not create directory \"%s\": %m", SNAPSHOT_DIR);
+		snapshot_remove(hosted_zone_id);
+		return;
+	}
+
+	int fd = OpenTransientFile(path, O_RDWR | O_CREAT | PG_BINARY);
+	if (fd < 0) {
+		elog(LOG, "r53db: could not open \"%s\": %m", path);
+		snapshot_remove(hosted_zone_id);
+		return;
+	}
+
+	// A new file reads as generation 0. The bump must survive a crash, or
+	// an older snapshot could become valid again.
+	errno = 0;
+	ssize_t nread = -1;
+	bool is_ok = (flock(fd, LOCK_EX) == 0 && (nread = pread(fd, &generation, sizeof(generation), 0)) >= 0);
+	if (is_ok) {
+		generation++;
+		is_ok = (pwrite(fd, &generation, sizeof(generation), 0) == sizeof(generation) && pg_fsync(fd) == 0);
+	}
+
+	if (is_ok && nread == 0) {
+		fsync_fname(SNAPSHOT_DIR, true);
+	}
+
+	if (!is_ok) {
+		if (errno == 0) errno = ENOSPC;
+		elog(LOG, "r53db: could not update \"%s\": %m", path);
+		snapshot_remove(hosted_zone_id);
+	}
+
+	CloseTransientFile(fd);
+}
+
+/*
+ * Seed the row estimate from a snapshot, for backends that haven't listed
+ * the zone themselves yet. It's only a planner hint, so we skip the
+ * (remote) RRSet count check here. Split points for parallel scans only
+ * come from real listings: A scan that a snapshot can serve isn't parallel
+ * anyway (see r53dbGetForeignPaths()).
+ */
+void snapshot_zone_stats(char *hosted_zone_id) {
+	r53dbSnapshotHeader header;
+
+	if (snapshot_read_header(hosted_zone_id, &header)) {
+		zone_stats_estimate(hosted_zone_id, header.nrows);
+	}
+}
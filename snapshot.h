@@ -0,0 +1,27 @@
+#ifndef R53DB_SNAPSHOT_H
+#define R53DB_SNAPSHOT_H
+
+#include <postgres.h>
+#include <nodes/pg_list.h>
+
+extern int r53db_snapshot_max_age;
+
+/*
+ * On-disk snapshots of full zone listings, in $PGDATA/pg_r53db. They let
+ * backends (and the broker) start warm instead of re-listing large zones.
+ *
+ * snapshot_load() appends the snapshot's rows to *rows if it's still valid
+ * for the zone's current RRSet count; the rows point into a read-only
+ * mapping that's released with CurrentMemoryContext.
+ *
+ * snapshot_invalidate() must be called around every change of a zone; a
+ * listing that started in an older generation isn't written.
+ */
+uint64 snapshot_generation(char *hosted_zone_id);
+bool snapshot_exists(char *hosted_zone_id);
+bool snapshot_load(char *hosted_zone_id, int64 rrset_count, List **rows);
+void snapshot_write(char *hosted_zone_id, int64 rrset_count, uint64 generation, List *results);
+void snapshot_invalidate(char *hosted_zone_id);
+void snapshot_zone_stats(char *hosted_zone_id);
+
+#endif // R53DB_SNAPSHOT_H
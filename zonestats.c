@@ -0,0 +1,79 @@
+#include <stdio.h>
+
+#include <postgres.h>
+#include <utils/hsearch.h>
+#include <utils/memutils.h>
+
+#include "compat.h"
+#include "dns.h"
+#include "zonestats.h"
+
+#define R53DB_MAX_RANGES 16
+
+// Zones smaller than this (per range) aren't worth splitting up
+int r53db_parallel_range_rows = 1000;
+
+static HTAB *zone_stats = NULL;
+
+static void zone_stats_init(void) {
+	HASHCTL ctl;
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = R53DB_ZONE_ID_LEN;
+	ctl.entrysize = sizeof(r53dbZoneStats);
+
+	// lives in TopMemoryContext
+	zone_stats = hash_create("r53db zone stats", 64, &ctl, HASH_ELEM | HASH_STRINGS);
+}
+
+void zone_stats_update(char *hosted_zone_id, List *results) {
+	bool found;
+
+	if (zone_stats == NULL) zone_stats_init();
+
+	r53dbZoneStats *stats = (r53dbZoneStats *) hash_search(zone_stats, hosted_zone_id, HASH_ENTER, &found);
+	if (found) {
+		list_free_deep(stats->split_points);
+	}
+
+	stats->nrows = list_length(results);
+	stats->split_points = NIL;
+
+	int nranges = Min(stats->nrows / r53db_parallel_range_rows, R53DB_MAX_RANGES);
+	char *prev = NULL;
+
+	MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+
+	for (int i = 1; i < nranges; i++) {
+		r53dbDNSRR *rr = (r53dbDNSRR *) list_nth(results, i * stats->nrows / nranges);
+
+		// ranges are split by name, so each name can only be used once
+		if (prev != NULL && strcmp(prev, rr->name) == 0) continue;
+
+		prev = pstrdup(rr->name);
+		stats->split_points = lappend(stats->split_points, prev);
+	}
+
+	MemoryContextSwitchTo(oldcontext);
+
+	elog(DEBUG1, "r53db: zone %s has %d rows, %d split points", hosted_zone_id, stats->nrows, list_length(stats->split_points));
+}
+
+// Just the number of rows (no split points), unless we know better already
+void zone_stats_estimate(char *hosted_zone_id, int nrows) {
+	bool found;
+
+	if (zone_stats == NULL) zone_stats_init();
+
+	r53dbZoneStats *stats = (r53dbZoneStats *) hash_search(zone_stats, hosted_zone_id, HASH_ENTER, &found);
+	if (found) return;
+
+	stats->nrows = nrows;
+	stats->split_points = NIL;
+}
+
+r53dbZoneStats *zone_stats_lookup(char *hosted_zone_id) {
+	if (zone_stats == NULL) return NULL;
+
+	return (r53dbZoneStats *) hash_search(zone_stats, hosted_zone_id, HASH_FIND, NULL);
+}
@@ -0,0 +1,26 @@
+#ifndef R53DB_ZONESTATS_H
+#define R53DB_ZONESTATS_H
+
+#include <postgres.h>
+#include <nodes/pg_list.h>
+
+#define R53DB_ZONE_ID_LEN 64
+
+extern int r53db_parallel_range_rows;
+
+/*
+ * What we learned about a Hosted Zone from its last full listing in this
+ * backend: the number of rows, and names that split the zone into ranges
+ * of roughly equal size (in Route53's listing order) for parallel scans.
+ */
+typedef struct r53dbZoneStats {
+	char hosted_zone_id[R53DB_ZONE_ID_LEN];
+	int nrows;
+	List *split_points;
+} r53dbZoneStats;
+
+void zone_stats_update(char *hosted_zone_id, List *results);
+void zone_stats_estimate(char *hosted_zone_id, int nrows);
+r53dbZoneStats *zone_stats_lookup(char *hosted_zone_id);
+
+#endif // R53DB_ZONESTATS_H